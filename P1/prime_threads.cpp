@@ -2,62 +2,635 @@
 // C++17
 // MSVC: cl /std:c++17 /O2 /EHsc prime_threads.cpp
 // g++  : g++ -std=gnu++17 -O2 -pthread prime_threads.cpp -o prime_threads
+// backend=omp needs OpenMP: add -fopenmp (g++) or /openmp:llvm (MSVC)
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <charconv>
 #include <cctype>
+#include <cerrno>
+#include <climits>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <queue>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <vector>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/uio.h>
+#endif
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define PT_HAVE_URING 1
+#endif
+#endif
+
 using u64 = unsigned long long;
 
 /* ---------- time ---------- */
 static inline auto nowtp() { return std::chrono::system_clock::now(); }
 
-static std::string ts_ms(std::chrono::system_clock::time_point tp) {
-    using namespace std::chrono;
-    auto t = system_clock::to_time_t(tp);
-    auto ms = duration_cast<milliseconds>(tp.time_since_epoch()) % 1000;
-    std::tm tm{};
+/* ---------- formatting ---------- */
+// Append-only text buffer built on std::to_chars. Each thread reuses one (tls_line),
+// so formatting a log line or table row never touches the heap once it has warmed up.
+struct LineBuf {
+    std::string s;
+
+    LineBuf() { s.reserve(1 << 12); }
+    void clear() { s.clear(); }
+    size_t size() const { return s.size(); }
+
+    LineBuf& str(const char* p, size_t n) { s.append(p, n); return *this; }
+    LineBuf& str(const std::string& v) { return str(v.data(), v.size()); }
+    LineBuf& str(const char* p) { return str(p, std::strlen(p)); }
+    LineBuf& ch(char c, size_t n = 1) { s.append(n, c); return *this; }
+    LineBuf& num(u64 v) {
+        char t[24];
+        auto r = std::to_chars(t, t + sizeof t, v);
+        return str(t, (size_t)(r.ptr - t));
+    }
+
+    // fixed-width fields: l* pads on the right, r* pads on the left with `fill`
+    LineBuf& lstr(const char* p, size_t n, int w) { str(p, n); return pad(n, w, ' '); }
+    LineBuf& lstr(const std::string& v, int w) { return lstr(v.data(), v.size(), w); }
+    LineBuf& lstr(const char* p, int w) { return lstr(p, std::strlen(p), w); }
+    LineBuf& rstr(const char* p, int w) { size_t n = std::strlen(p); pad(n, w, ' '); return str(p, n); }
+    LineBuf& lnum(u64 v, int w) {
+        char t[24];
+        auto r = std::to_chars(t, t + sizeof t, v);
+        return lstr(t, (size_t)(r.ptr - t), w);
+    }
+    LineBuf& rnum(u64 v, int w, char fill = ' ') {
+        char t[24];
+        auto r = std::to_chars(t, t + sizeof t, v);
+        size_t n = (size_t)(r.ptr - t);
+        pad(n, w, fill);
+        return str(t, n);
+    }
+
+    // "YYYY-MM-DD HH:MM:SS.mmm" (23 chars); localtime runs once per second per thread
+    LineBuf& ts(std::chrono::system_clock::time_point tp) {
+        using namespace std::chrono;
+        thread_local std::time_t last = (std::time_t)-1;
+        thread_local char head[24];
+        auto t = system_clock::to_time_t(tp);
+        if (t != last) {
+            std::tm tm{};
 #if defined(_WIN32)
-    localtime_s(&tm, &t);
+            localtime_s(&tm, &t);
 #else
-    localtime_r(&t, &tm);
+            localtime_r(&t, &tm);
 #endif
-    std::ostringstream os;
-    os << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << "."
-        << std::setw(3) << std::setfill('0') << ms.count();
-    return os.str();
+            std::strftime(head, sizeof head, "%Y-%m-%d %H:%M:%S", &tm);
+            last = t;
+        }
+        auto ms = duration_cast<milliseconds>(tp.time_since_epoch()) % 1000;
+        return str(head).ch('.').rnum((u64)ms.count(), 3, '0');
+    }
+
+private:
+    LineBuf& pad(size_t n, int w, char fill) {
+        if ((int)n < w) s.append((size_t)w - n, fill);
+        return *this;
+    }
+};
+
+static LineBuf& tls_line() { thread_local LineBuf b; return b; }
+
+/* ---------- async output ---------- */
+// Sequential byte stream to a file descriptor over `nbuf` rotating buffers: callers fill
+// one while the kernel writes the others. On Linux the writes go through io_uring (raw
+// syscalls, no liburing); where that is missing or refused, a writer thread issues
+// pwrite/write instead. write() is thread-safe and only blocks when every buffer is in flight.
+// zero_copy: when the fd is a pipe, full buffers are vmspliced (the pipe references our pages
+// instead of copying them). Buffers are page-aligned and at least the pipe's capacity, so by
+// the time one comes round again the next full buffer has pushed it out of the pipe.
+class AsyncWriter {
+public:
+    AsyncWriter(size_t buf_bytes, int nbuf, bool zero_copy = false)
+        : bufs((size_t)std::max(2, nbuf)), want_splice(zero_copy) {
+        alloc(std::max<size_t>(buf_bytes, 4096));
+    }
+    ~AsyncWriter() { close(); }
+
+    bool open_path(const std::string& path) {
+#if defined(_WIN32)
+        if (_sopen_s(&fd, path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0) return false;
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+#endif
+        own_fd = true;
+        start();
+        return true;
+    }
+    // shared: other processes write fd 1 too, so write at its file offset, one buffer at a time
+    void attach_stdout(bool shared = false) {
+        shared_fd = shared;
+        std::fflush(stdout);
+#if defined(_WIN32)
+        fd = _fileno(stdout);
+#else
+        fd = 1;
+#endif
+        start();
+    }
+    const char* backend() const { return splice ? "vmsplice" : ring ? "io_uring" : "writer thread"; }
+    bool splicing() const { return splice; }
+
+    // zero_copy: move n bytes of a file into the pipe with splice(), after what is buffered
+    bool send_file(const std::string& path, u64 n) {
+#if defined(__linux__)
+        if (!splice) return false;
+        flush();
+        int in = ::open(path.c_str(), O_RDONLY);
+        if (in < 0) return false;
+        loff_t at = 0;
+        while (n) {
+            ssize_t w = ::splice(in, &at, fd, nullptr, (size_t)std::min<u64>(n, 1u << 30), SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (w <= 0) break;
+            n -= (u64)w;
+        }
+        ::close(in);
+        return n == 0;
+#else
+        (void)path; (void)n;
+        return false;
+#endif
+    }
+
+    void write(const char* p, size_t n) {
+        std::unique_lock<std::mutex> lk(m);
+        while (n) {
+            Buf& b = bufs[cur];
+            size_t k = std::min(n, b.cap - b.len);
+            std::memcpy(b.d + b.len, p, k);
+            b.len += k; p += k; n -= k;
+            if (b.len == b.cap) rotate(lk);
+        }
+    }
+
+    // everything written so far reaches the kernel before this returns
+    void flush() {
+        std::unique_lock<std::mutex> lk(m);
+        if (splice) {
+            // a partial buffer is copied, so it can be refilled at once
+            Buf& b = bufs[cur];
+            if (!write_all(fd, b.d, b.len, 0, false)) std::cerr << "WARN: async write failed\n";
+            b.len = 0;
+            return;
+        }
+        if (bufs[cur].len) rotate(lk);
+        while (in_flight) reap(lk);
+#if !defined(_WIN32)
+        // positioned writes leave the file offset alone; an inherited fd must end up past our bytes
+        if (seekable && !own_fd) ::lseek(fd, (off_t)offset, SEEK_SET);
+#endif
+    }
+
+    void close() {
+        if (fd < 0) return;
+        flush();
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stop = true;
+        }
+        cv.notify_all();
+        if (th.joinable()) th.join();
+#if defined(PT_HAVE_URING)
+        if (ring) ring_close();
+#endif
+#if defined(_WIN32)
+        if (own_fd) _close(fd);
+#else
+        if (own_fd) ::close(fd);
+#endif
+        fd = -1;
+    }
+
+private:
+    struct Buf { std::vector<char> raw; char* d = nullptr; size_t cap = 0, len = 0; u64 off = 0; bool busy = false; };
+    std::vector<Buf> bufs;
+    bool want_splice = false, splice = false;
+    size_t cur = 0;
+    int in_flight = 0, max_flight = 1;
+    int fd = -1;
+    bool own_fd = false, shared_fd = false, seekable = false, stop = false, ring = false;
+    u64 offset = 0;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<size_t> queue;  // writer-thread backend
+    std::thread th;
+
+    void alloc(size_t bytes) {
+        const size_t page = 4096;
+        bytes = (bytes + page - 1) / page * page;
+        for (auto& b : bufs) {
+            b.raw.assign(bytes + page, 0);
+            b.d = (char*)(((uintptr_t)b.raw.data() + page - 1) & ~(uintptr_t)(page - 1));
+            b.cap = bytes;
+        }
+    }
+
+    void start() {
+#if defined(__linux__)
+        struct stat st;
+        if (want_splice && ::fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            int ps = ::fcntl(fd, F_GETPIPE_SZ);
+            if (ps > 0) {
+                // shrink the pipe to one buffer if allowed, otherwise grow the buffers to the pipe
+                int want = (int)std::min<size_t>(bufs[0].cap, 1u << 30);
+                if ((size_t)ps > bufs[0].cap) { int got = ::fcntl(fd, F_SETPIPE_SZ, want); if (got > 0) ps = got; }
+                if ((size_t)ps > bufs[0].cap) alloc((size_t)ps);
+                splice = true;
+                return;
+            }
+        }
+#endif
+#if defined(_WIN32)
+        seekable = _lseeki64(fd, 0, SEEK_CUR) >= 0 && own_fd;
+#else
+        off_t at = ::lseek(fd, 0, SEEK_CUR);
+        // O_APPEND ignores write offsets, so overlapping writes could land out of order
+        int fl = ::fcntl(fd, F_GETFL);
+        seekable = at >= 0 && !shared_fd && (fl < 0 || !(fl & O_APPEND));
+        if (seekable) offset = (u64)at;
+#endif
+        // pipes/terminals have no offsets, so only one write may be outstanding there
+        max_flight = seekable ? (int)bufs.size() - 1 : 1;
+#if defined(PT_HAVE_URING)
+        ring = ring_init((unsigned)bufs.size());
+#endif
+        if (!ring) th = std::thread([this] { writer_loop(); });
+    }
+
+    // hand bufs[cur] to the kernel and move on to a free buffer
+    void rotate(std::unique_lock<std::mutex>& lk) {
+        while (in_flight >= max_flight) reap(lk);
+        Buf& b = bufs[cur];
+#if defined(__linux__)
+        if (splice) {
+            vmsplice_all(b);
+            offset += b.len;
+            b.len = 0;
+            cur = (cur + 1) % bufs.size();
+            return;
+        }
+#endif
+        b.busy = true;
+        b.off = offset;
+        ++in_flight;
+#if defined(PT_HAVE_URING)
+        if (ring) ring_write(cur, b.d, b.len, seekable ? offset : (u64)-1);
+        else
+#endif
+        { queue.push_back(cur); cv.notify_all(); }
+        offset += b.len;
+        cur = (cur + 1) % bufs.size();
+        while (bufs[cur].busy) reap(lk);
+    }
+
+    // wait for one outstanding write to finish
+    void reap(std::unique_lock<std::mutex>& lk) {
+#if defined(PT_HAVE_URING)
+        if (ring) { ring_reap(); return; }
+#endif
+        int before = in_flight;
+        cv.wait(lk, [&] { return in_flight < before; });
+    }
+
+    static bool write_all(int f, const char* p, size_t n, u64 off, bool at) {
+        while (n) {
+#if defined(_WIN32)
+            (void)off; (void)at;
+            int w = _write(f, p, (unsigned)std::min<size_t>(n, 1u << 30));
+#else
+            ssize_t w = at ? ::pwrite(f, p, n, (off_t)off) : ::write(f, p, n);
+#endif
+            if (w <= 0) return false;
+            p += w; n -= (size_t)w; off += (u64)w;
+        }
+        return true;
+    }
+
+#if defined(__linux__)
+    void vmsplice_all(const Buf& b) {
+        iovec v{ b.d, b.len };
+        while (v.iov_len) {
+            ssize_t w = ::vmsplice(fd, &v, 1, 0);
+            if (w <= 0) {
+                if (!write_all(fd, (const char*)v.iov_base, v.iov_len, 0, false)) std::cerr << "WARN: async write failed\n";
+                return;
+            }
+            v.iov_base = (char*)v.iov_base + w;
+            v.iov_len -= (size_t)w;
+        }
+    }
+#endif
+
+    void writer_loop() {
+        std::unique_lock<std::mutex> lk(m);
+        for (;;) {
+            cv.wait(lk, [&] { return stop || !queue.empty(); });
+            if (queue.empty()) return;
+            size_t i = queue.front();
+            queue.pop_front();
+            Buf& b = bufs[i];
+            lk.unlock();
+            if (!write_all(fd, b.d, b.len, b.off, seekable)) std::cerr << "WARN: async write failed\n";
+            lk.lock();
+            b.len = 0;
+            b.busy = false;
+            --in_flight;
+            cv.notify_all();
+        }
+    }
+
+#if defined(PT_HAVE_URING)
+    int rfd = -1;
+    void* sq_ptr = nullptr; void* cq_ptr = nullptr; io_uring_sqe* sqes = nullptr;
+    size_t sq_len = 0, cq_len = 0, sqe_len = 0;
+    unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    bool ring_init(unsigned entries) {
+        io_uring_params p{};
+        rfd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+        if (rfd < 0) return false;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sq_len = cq_len = std::max(sq_len, cq_len);
+        sq_ptr = ::mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQ_RING);
+        cq_ptr = single ? sq_ptr : ::mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_CQ_RING);
+        sqe_len = p.sq_entries * sizeof(io_uring_sqe);
+        void* sq_entries = ::mmap(nullptr, sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQES);
+        if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sq_entries == MAP_FAILED) {
+            if (sq_ptr != MAP_FAILED) ::munmap(sq_ptr, sq_len);
+            if (!single && cq_ptr != MAP_FAILED) ::munmap(cq_ptr, cq_len);
+            if (sq_entries != MAP_FAILED) ::munmap(sq_entries, sqe_len);
+            ::close(rfd);
+            rfd = -1;
+            return false;
+        }
+        char* sq = (char*)sq_ptr;
+        char* cq = (char*)cq_ptr;
+        sqes = (io_uring_sqe*)sq_entries;
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    void ring_write(size_t i, const char* p, size_t n, u64 off) {
+        unsigned tail = *sq_tail;
+        unsigned idx = tail & *sq_mask;
+        io_uring_sqe* e = &sqes[idx];
+        std::memset(e, 0, sizeof *e);
+        e->opcode = IORING_OP_WRITE;
+        e->fd = fd;
+        e->addr = (unsigned long long)(uintptr_t)p;
+        e->len = (unsigned)n;
+        e->off = off;
+        e->user_data = i;
+        sq_array[idx] = idx;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        long r;
+        do r = ::syscall(__NR_io_uring_enter, rfd, 1, 0, 0, nullptr, 0);
+        while (r < 0 && errno == EINTR);
+        if (r == 1) return;
+        // not submitted: take the entry back and write it here instead
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        Buf& b = bufs[i];
+        if (!write_all(fd, p, n, off, seekable)) std::cerr << "WARN: async write failed\n";
+        b.len = 0;
+        b.busy = false;
+        --in_flight;
+    }
+
+    void ring_reap() {
+        for (;;) {
+            unsigned head = *cq_head;
+            if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe* e = &cqes[head & *cq_mask];
+                Buf& b = bufs[(size_t)e->user_data];
+                int res = e->res;
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                // short or failed write: finish the rest synchronously so the stream stays whole
+                if (res < (int)b.len) {
+                    size_t done = res > 0 ? (size_t)res : 0;
+                    if (!write_all(fd, b.d + done, b.len - done, b.off + done, seekable)) std::cerr << "WARN: async write failed\n";
+                }
+                b.len = 0;
+                b.busy = false;
+                --in_flight;
+                return;
+            }
+            ::syscall(__NR_io_uring_enter, rfd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        }
+    }
+
+    void ring_close() {
+        ::munmap(sqes, sqe_len);
+        if (cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_len);
+        ::munmap(sq_ptr, sq_len);
+        ::close(rfd);
+        ring = false;
+    }
+#endif
+};
+
+// async_output=1 routes every stdout writer below through this
+static AsyncWriter* g_async_out = nullptr;
+
+#if !defined(_WIN32)
+// procs>1: worker processes share stdout, and stdio would flush at arbitrary byte counts.
+// Whole lines are batched instead and written in pieces of at most PIPE_BUF bytes, which
+// the kernel never interleaves with another process's writes. In immediate mode every
+// line is written as it comes, so it shows up when it is logged.
+struct ProcOut {
+    std::mutex m;
+    std::string s;
+    bool lines = false;  // write each put() at once instead of batching
+
+    void put(const char* p, size_t n) {
+        std::lock_guard<std::mutex> lk(m);
+        if (lines || s.size() + n > PIPE_BUF) drain();
+        if (lines) { raw(p, n); return; }
+        if (n > PIPE_BUF) raw(p, n);
+        else s.append(p, n);
+    }
+    void flush() { std::lock_guard<std::mutex> lk(m); drain(); }
+
+private:
+    void drain() { raw(s.data(), s.size()); s.clear(); }
+    static void raw(const char* p, size_t n) {
+        while (n) {
+            const ssize_t w = ::write(1, p, n);
+            if (w <= 0) return;
+            p += w; n -= (size_t)w;
+        }
+    }
+};
+static ProcOut* g_proc_out = nullptr;
+#endif
+
+// stdio locks the stream per call, so one fwrite per line never tears between threads
+static void out_write(const LineBuf& b) {
+    if (!b.size()) return;
+    if (g_async_out) g_async_out->write(b.s.data(), b.size());
+#if !defined(_WIN32)
+    else if (g_proc_out) g_proc_out->put(b.s.data(), b.size());
+#endif
+    else std::fwrite(b.s.data(), 1, b.size(), stdout);
+}
+
+// block writers (deferred flush, tables, prime lists) hand off in ~1 MB pieces
+static constexpr size_t OUT_CHUNK = 1 << 20;
+static void out_spill(LineBuf& b, bool force = false) {
+    if (force || b.size() >= OUT_CHUNK) { out_write(b); b.clear(); }
 }
 
 /* ---------- config ---------- */
+// PRIME/CHECK sampling: "all" | "every:K" | "rate:R" (lines/s per thread) | "aggregate:MS"
+enum class Sample { ALL, EVERY, RATE, AGGREGATE };
+struct SamplePolicy {
+    Sample kind = Sample::ALL;
+    u64    arg = 0;  // K, R or interval ms
+};
+
 struct Config {
     int         threads = 8;
     u64         max_value = 50000;
-    std::string division = "range";      // "range" | "per_number"
+    std::string division = "range";      // "range" | "per_number" | "adaptive" (config only, kept over the variant)
     std::string printing = "immediate";  // "immediate" | "deferred"
     bool        skip_even = true;
     bool        use_6k = false;
     int         log_every = -1;           // for B1 immediate; -1 = no CHECK lines
     bool        list_primes = false;
     bool        table_sum = true;
+    bool        thread_stats = false;     // per-thread table: add Divisions and Busy ms columns
+    std::string log_format = "text";      // "text" | "binary"
+    std::string log_file = "prime_threads.ptlog"; // binary sink target
+    u64         deferred_memory_limit = 0;  // bytes (K/M/G suffix ok); 0 = keep all deferred events in RAM
+    std::string log_level = "trace";      // "off" | "info" (RUN/START/FIN) | "debug" (+PRIME) | "trace" (+CHECK)
+    std::string log_tags = "all";         // comma list of tags to keep, e.g. "RUN,START,FIN"
+    SamplePolicy prime_log;               // which PRIME events become lines
+    SamplePolicy check_log;               // same for CHECK (after log_every)
+    std::string result = "store";         // "store" (Result.primes) | "stream" (sinks only, bounded memory)
+    u64         segment = 1 << 16;        // stream: numbers per B1 chunk / primes per B2 chunk
+    std::string primes_file;              // stream: write primes here, one per line
+    std::string prime_store = "vector";   // store: "vector" (u64 each) | "gaps" (GapStore, ~1 byte each)
+    std::string output_file;              // store: write all primes here after the run (parallel, mmap)
+    std::string output_format = "text";   // "text" (one per line) | "u64" (raw) | "varint" (delta varints)
+    std::string db_file;                  // store: save an indexed prime database (see "query")
+    std::string cache_file;               // frontier cache: later runs only test (frontier, max_value]
+    u64         start_after = 0;          // set from cache_file; numbers <= this are already counted
+    std::string checkpoint_file;          // progress snapshot for crash recovery (empty = off)
+    u64         checkpoint_ms = 10000;    // snapshot period
+    bool        resume = false;           // continue from checkpoint_file instead of starting over
+    bool        ordered = false;          // A1B1: PRIME lines in increasing order (chunks of `segment`)
+    u64         ordered_window = 64;      // max chunks in flight past the oldest unfinished one
+    bool        async_output = false;     // stdout + primes_file through AsyncWriter (io_uring on Linux)
+    u64         async_buffer = 1 << 20;   // bytes per async buffer
+    int         async_buffers = 3;        // buffers per writer (2 = double, 3 = triple buffering)
+    bool        zero_copy = false;        // stdout is a pipe: vmsplice buffers / splice files into it (Linux)
+    std::string affinity = "none";        // "none" | "compact" | "scatter" | "list:0-3,8"
+    std::vector<int> pin_cpus;            // resolved from affinity; worker t runs on pin_cpus[t % size]
+    bool        threads_auto = false;     // threads=auto: size from affinity mask, cgroup quota, smt
+    bool        smt = true;               // threads=auto: count SMT siblings (0 = one per physical core)
+    u64         batch = 1;                // B2: candidates per divisor pass (1 = one number at a time)
+    u64         crossover = 0;            // adaptive: first number given to divisor splitting (0 = calibrate)
+    std::string backend = "threads";      // "threads" (std::thread) | "omp" (OpenMP runtime, needs -fopenmp)
+    std::string omp_schedule = "static";  // omp: "static" | "dynamic" | "guided"
+    int         omp_chunk = 0;            // omp: schedule chunk (0 = runtime default)
+    bool        pipeline = false;         // B1: compute -> analytics -> output stages over SPSC queues
+    int         analytics_threads = 1;    // pipeline: threads in the analytics stage
+    int         output_threads = 1;       // pipeline: threads in the output stage
+    int         procs = 1;                // POSIX: worker processes, each running `threads` on a slice (1 = off)
+    u64         lease_chunk = 1000000;    // serve: numbers per leased chunk
+    u64         lease_ms = 60000;         // serve: a chunk not returned within this is leased again
 };
 
+// ordered=1 only changes A1B1 (immediate + range)
+static bool ordered_mode(const Config& c) { return c.ordered && c.division == "range" && c.printing == "immediate"; }
+
 static std::string trim(std::string s) {
     auto a = s.find_first_not_of(" \t\r\n");
     auto b = s.find_last_not_of(" \t\r\n");
     if (a == std::string::npos) return {};
     return s.substr(a, b - a + 1);
 }
+static SamplePolicy parse_sample(const std::string& v) {
+    SamplePolicy p;
+    auto colon = v.find(':');
+    std::string kind = trim(v.substr(0, colon));
+    u64 arg = (colon == std::string::npos) ? 0 : std::stoull(trim(v.substr(colon + 1)));
+    if (kind == "every")          p = { Sample::EVERY, std::max<u64>(1, arg) };
+    else if (kind == "rate")      p = { Sample::RATE, arg };
+    else if (kind == "aggregate") p = { Sample::AGGREGATE, arg ? arg : 1000 };
+    return p;
+}
+// "64M", "2G", "4096" -> bytes
+static u64 parse_size(const std::string& v) {
+    size_t pos = 0;
+    u64 x = std::stoull(v, &pos);
+    switch (pos < v.size() ? std::toupper((unsigned char)v[pos]) : 0) {
+    case 'K': return x << 10;
+    case 'M': return x << 20;
+    case 'G': return x << 30;
+    default:  return x;
+    }
+}
 static Config parse_cfg(std::istream& in) {
     Config c;
     std::string line;
@@ -73,7 +646,8 @@ static Config parse_cfg(std::istream& in) {
         std::string k = trim(line.substr(0, eq));
         std::string v = trim(line.substr(eq + 1));
 
-        if (k == "threads")       c.threads = std::max(1, std::stoi(v));
+        if (k == "threads")       { c.threads_auto = (v == "auto" || v == "Auto"); if (!c.threads_auto) c.threads = std::max(1, std::stoi(v)); }
+        else if (k == "smt")           c.smt = (v == "1" || v == "true" || v == "True");
         else if (k == "max_value")     c.max_value = static_cast<u64>(std::stoull(v));
         else if (k == "division")      c.division = v;
         else if (k == "printing")      c.printing = v;
@@ -82,6 +656,43 @@ static Config parse_cfg(std::istream& in) {
         else if (k == "log_every")     c.log_every = std::stoi(v);
         else if (k == "list_primes")   c.list_primes = (v == "1" || v == "true" || v == "True");
         else if (k == "table_summary") c.table_sum = (v == "1" || v == "true" || v == "True");
+        else if (k == "thread_stats")  c.thread_stats = (v == "1" || v == "true" || v == "True");
+        else if (k == "log_format")    c.log_format = v;
+        else if (k == "log_file")      c.log_file = v;
+        else if (k == "deferred_memory_limit") c.deferred_memory_limit = parse_size(v);
+        else if (k == "log_level")     c.log_level = v;
+        else if (k == "log_tags")      c.log_tags = v;
+        else if (k == "prime_log")     c.prime_log = parse_sample(v);
+        else if (k == "check_log")     c.check_log = parse_sample(v);
+        else if (k == "result")        c.result = v;
+        else if (k == "segment")       c.segment = std::max<u64>(1, std::stoull(v));
+        else if (k == "primes_file")   c.primes_file = v;
+        else if (k == "prime_store")   c.prime_store = v;
+        else if (k == "output_file")   c.output_file = v;
+        else if (k == "output_format") c.output_format = v;
+        else if (k == "db_file")       c.db_file = v;
+        else if (k == "cache_file")    c.cache_file = v;
+        else if (k == "checkpoint_file") c.checkpoint_file = v;
+        else if (k == "checkpoint_ms") c.checkpoint_ms = std::max<u64>(1, std::stoull(v));
+        else if (k == "resume")        c.resume = (v == "1" || v == "true" || v == "True");
+        else if (k == "ordered")       c.ordered = (v == "1" || v == "true" || v == "True");
+        else if (k == "ordered_window") c.ordered_window = std::max<u64>(1, std::stoull(v));
+        else if (k == "async_output")  c.async_output = (v == "1" || v == "true" || v == "True");
+        else if (k == "async_buffer")  c.async_buffer = std::max<u64>(4096, parse_size(v));
+        else if (k == "async_buffers") c.async_buffers = std::max(2, std::stoi(v));
+        else if (k == "zero_copy")     c.zero_copy = (v == "1" || v == "true" || v == "True");
+        else if (k == "affinity")      c.affinity = v;
+        else if (k == "batch")         c.batch = std::max<u64>(1, std::stoull(v));
+        else if (k == "crossover")     c.crossover = std::stoull(v);
+        else if (k == "backend")       c.backend = v;
+        else if (k == "omp_schedule")  c.omp_schedule = v;
+        else if (k == "omp_chunk")     c.omp_chunk = std::max(0, std::stoi(v));
+        else if (k == "pipeline")      c.pipeline = (v == "1" || v == "true" || v == "True");
+        else if (k == "analytics_threads") c.analytics_threads = std::max(1, std::stoi(v));
+        else if (k == "output_threads") c.output_threads = std::max(1, std::stoi(v));
+        else if (k == "procs")         c.procs = std::max(1, std::stoi(v));
+        else if (k == "lease_chunk")   c.lease_chunk = std::max<u64>(1, std::stoull(v));
+        else if (k == "lease_ms")      c.lease_ms = std::max<u64>(1, std::stoull(v));
     }
     return c;
 }
@@ -94,23 +705,264 @@ static Config load_cfg(const std::string& path) {
     return parse_cfg(in);
 }
 
-/* ---------- logger ---------- */
+/* ---------- result cache ---------- */
+// cache_file: key=value text like config.ini. Primality here is trial division, so the
+// frontier and its prime count are all a later run needs to pick up at frontier+1.
+struct RunCache {
+    u64  frontier = 0;
+    u64  primes = 0;
+    bool skip_even = true;
+    bool use_6k = false;
+};
+
+static bool load_cache(const std::string& path, RunCache& rc) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    bool have = false;
+    while (std::getline(in, line)) {
+        auto eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string k = trim(line.substr(0, eq)), v = trim(line.substr(eq + 1));
+        if (k == "frontier")       { rc.frontier = std::stoull(v); have = true; }
+        else if (k == "primes")    rc.primes = std::stoull(v);
+        else if (k == "skip_even") rc.skip_even = (v == "1");
+        else if (k == "use_6k")    rc.use_6k = (v == "1");
+    }
+    return have;
+}
+
+// written beside the target and renamed over it, so a crash never leaves half a cache
+static bool save_cache(const std::string& path, const RunCache& rc) {
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << "frontier=" << rc.frontier << "\n" << "primes=" << rc.primes << "\n"
+            << "skip_even=" << (rc.skip_even ? 1 : 0) << "\n" << "use_6k=" << (rc.use_6k ? 1 : 0) << "\n";
+        if (!out) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+
+/* ---------- events ---------- */
 enum class PrintMode { IMMEDIATE, DEFERRED };
 
+enum class Tag : unsigned char { RUN, START, CHECK, PRIME, FIN };
+static const char* tag_name(Tag t) {
+    static const char* const names[] = { "RUN", "START", "CHECK", "PRIME", "FIN" };
+    return names[(int)t];
+}
+constexpr unsigned tag_bit(Tag t) { return 1u << (unsigned)t; }
+
+// Compile-time tag mask. Tags outside it are compiled out of the B1/B2 hot loops,
+// e.g. /DPT_LOG_TAGS=0x13 (RUN|START|FIN) builds a binary that can never log PRIME/CHECK.
+#ifndef PT_LOG_TAGS
+#define PT_LOG_TAGS 0x1Fu
+#endif
+
+// Hot-loop logging policy; run_B1/run_B2 are instantiated per policy so a disabled
+// tag costs neither a call nor a branch per number.
+template <bool Primes, bool Checks>
+struct HotLog {
+    static constexpr bool primes = Primes && (PT_LOG_TAGS & tag_bit(Tag::PRIME)) != 0;
+    static constexpr bool checks = Checks && (PT_LOG_TAGS & tag_bit(Tag::CHECK)) != 0;
+};
+
+// log_level + log_tags -> enabled-tag mask, resolved once at startup
+static unsigned resolve_tag_mask(const std::string& level, const std::string& tags) {
+    std::string lv;
+    for (char ch : level) lv.push_back((char)std::tolower((unsigned char)ch));
+    unsigned m = tag_bit(Tag::RUN) | tag_bit(Tag::START) | tag_bit(Tag::FIN);
+    if (lv == "off" || lv == "quiet") m = 0;
+    else if (lv == "debug") m |= tag_bit(Tag::PRIME);
+    else if (lv != "info") m |= tag_bit(Tag::PRIME) | tag_bit(Tag::CHECK);
+
+    std::string t = trim(tags);
+    if (!t.empty() && t != "all" && t != "ALL") {
+        unsigned keep = 0;
+        std::stringstream ss(t);
+        std::string tok;
+        while (std::getline(ss, tok, ',')) {
+            tok = trim(tok);
+            for (auto& ch : tok) ch = (char)std::toupper((unsigned char)ch);
+            for (int i = 0; i <= (int)Tag::FIN; ++i)
+                if (tok == tag_name((Tag)i)) keep |= tag_bit((Tag)i);
+        }
+        m &= keep;
+    }
+    return m & PT_LOG_TAGS;
+}
+
 struct Ev {
     std::chrono::system_clock::time_point tp;
     int         tid;
-    std::string tag;  // RUN/START/PRIME/FIN
+    Tag         tag;
+    u64         n = 0;  // PRIME/CHECK payload (kept numeric so deferred mode stores no string)
     std::string msg;
 };
 
+/* ---------- binary log ---------- */
+// Compact event stream for log_format=binary. Layout:
+//   header : "PTLOG1\n\0", u8 printing (0 immediate / 1 deferred), u8 pad, u16 w_tid
+//   blocks : i64 base_us, u32 payload bytes, then records
+//   record : u8 tag (|0x80 = text payload), varint tid+1, zigzag varint dt_us (vs previous record),
+//            numeric: varint dn (vs previous value)  |  text: varint len + text
+// Every thread encodes into its own buffer and appends whole blocks under one lock,
+// so a PRIME costs a few byte stores and lands in ~4 bytes on disk.
+static const char PTLOG_MAGIC[8] = { 'P','T','L','O','G','1','\n','\0' };
+
+static inline void put_varint(std::string& o, u64 v) {
+    while (v >= 0x80) { o.push_back((char)(v | 0x80)); v >>= 7; }
+    o.push_back((char)v);
+}
+static inline bool get_varint(const unsigned char*& p, const unsigned char* e, u64& v) {
+    v = 0;
+    for (int sh = 0; p < e && sh < 64; sh += 7) {
+        unsigned char b = *p++;
+        v |= (u64)(b & 0x7f) << sh;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+template <class T> static inline void put_raw(std::string& o, T v) { o.append((const char*)&v, sizeof v); }
+
+static inline long long to_us(std::chrono::system_clock::time_point tp) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(tp.time_since_epoch()).count();
+}
+
+static u64 process_id() {
+#if defined(_WIN32)
+    return (u64)GetCurrentProcessId();
+#else
+    return (u64)getpid();
+#endif
+}
+
+// unique scratch file in the temp directory (deferred spill runs, sink spools)
+static std::string temp_path(const void* owner, const std::string& suffix) {
+    return (std::filesystem::temp_directory_path() /
+        ("prime_threads_" + std::to_string(process_id()) + "_" + std::to_string(to_us(nowtp())) + "_" +
+            std::to_string((u64)(uintptr_t)owner) + "_" + suffix)).string();
+}
+
+struct BinLog {
+    static constexpr size_t BLOCK = 1 << 16;
+
+    struct Local {
+        BinLog* owner = nullptr;
+        std::string buf;
+        long long last_us = 0;
+        u64 last_n = 0;
+        ~Local() { if (owner) owner->release(*this); }
+    };
+
+    std::ofstream out;
+    std::mutex m;
+    std::vector<char> iobuf;
+    std::vector<Local*> locals;  // every thread's buffer, so close() also reaches idle pool threads
+
+    bool open(const std::string& path, PrintMode pm, int w_tid) {
+        iobuf.resize(1 << 20);
+        out.rdbuf()->pubsetbuf(iobuf.data(), (std::streamsize)iobuf.size());
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        std::string h(PTLOG_MAGIC, sizeof PTLOG_MAGIC);
+        h.push_back((char)(pm == PrintMode::DEFERRED ? 1 : 0));
+        h.push_back(0);
+        put_raw<unsigned short>(h, (unsigned short)w_tid);
+        out.write(h.data(), (std::streamsize)h.size());
+        return true;
+    }
+
+    Local& local() {
+        thread_local Local l;
+        if (l.owner != this) {
+            if (l.owner) l.owner->release(l);
+            l.owner = this;
+            std::lock_guard<std::mutex> lk(m);
+            locals.push_back(&l);
+        }
+        return l;
+    }
+
+    void put(int tid, Tag tag, u64 n, const std::string* msg) {
+        Local& l = local();
+        long long us = to_us(nowtp());
+        if (l.buf.empty()) {
+            put_raw<long long>(l.buf, us);
+            put_raw<unsigned>(l.buf, 0u);  // patched by flush
+            l.last_us = us; l.last_n = 0;
+        }
+        long long dt = us - l.last_us;
+        l.buf.push_back((char)((unsigned)tag | (msg ? 0x80u : 0u)));
+        put_varint(l.buf, (u64)(tid + 1));
+        put_varint(l.buf, (u64)((dt << 1) ^ (dt >> 63)));
+        if (msg) { put_varint(l.buf, msg->size()); l.buf.append(*msg); }
+        else     { put_varint(l.buf, n - l.last_n); l.last_n = n; }
+        l.last_us = us;
+        if (l.buf.size() >= BLOCK) flush(l);
+    }
+
+    void flush(Local& l) {
+        if (l.buf.empty()) return;
+        std::lock_guard<std::mutex> lk(m);
+        write_block(l);
+    }
+
+    // thread exit (or a switch to another BinLog): last block, then forget the buffer
+    void release(Local& l) {
+        std::lock_guard<std::mutex> lk(m);
+        write_block(l);
+        locals.erase(std::remove(locals.begin(), locals.end(), &l), locals.end());
+        l.owner = nullptr;
+    }
+
+    // every thread's pending block, then the file. OpenMP pool threads outlive the
+    // parallel region and would only flush on exit, after the file is closed.
+    void close() {
+        std::lock_guard<std::mutex> lk(m);
+        for (Local* l : locals) { write_block(*l); l->owner = nullptr; }
+        locals.clear();
+        out.close();
+    }
+
+private:
+    void write_block(Local& l) {  // m held
+        if (l.buf.empty()) return;
+        unsigned len = (unsigned)(l.buf.size() - sizeof(long long) - sizeof(unsigned));
+        std::memcpy(&l.buf[sizeof(long long)], &len, sizeof len);
+        out.write(l.buf.data(), (std::streamsize)l.buf.size());
+        l.buf.clear();
+    }
+};
+
+/* ---------- logger ---------- */
 struct Logger {
     PrintMode mode{ PrintMode::IMMEDIATE };
     std::mutex m;
     std::vector<Ev> buf;
+    BinLog* bin = nullptr;  // log_format=binary: every event goes here instead
+    unsigned mask = PT_LOG_TAGS;
     int w_time = 23, w_tid = 2, w_tag = 6;
+    int tid_base = 0;       // procs>1: worker process k logs its threads as k*threads + t
+    std::string run_prefix; // procs>1: prepended to a worker process's RUN lines
+
+    // deferred_memory_limit: once buf reaches it, it is sorted and spilled as a run file
+    size_t mem_limit = 0, buf_bytes = 0;
+    std::vector<std::string> runs;
+    std::mutex run_m;
 
     explicit Logger(PrintMode pm) : mode(pm) {}
+    ~Logger() { for (auto& f : runs) { std::error_code ec; std::filesystem::remove(f, ec); } }
+
+    bool on(Tag t) const { return (mask & tag_bit(t)) != 0; }
+
+    void set_memory_limit(u64 bytes) {
+        mem_limit = (size_t)bytes;
+        if (mem_limit) buf.reserve(mem_limit / sizeof(Ev) + 1);
+    }
 
     void set_width(int T) {
         int w = 1, x = std::max(1, T - 1);
@@ -118,226 +970,2099 @@ struct Logger {
         w_tid = std::max(2, w);
     }
 
-    void add(int tid, std::string tag, std::string msg) {
-        Ev e{ nowtp(), tid, std::move(tag), std::move(msg) };
-        if (mode == PrintMode::IMMEDIATE) {
-            std::ostringstream os;
-            os << std::left << std::setw(w_time) << ts_ms(e.tp) << "  "
-                << "T" << std::right << std::setw(w_tid) << std::setfill('0') << (tid >= 0 ? tid : 0)
-                << std::setfill(' ') << "  "
-                << std::left << std::setw(w_tag) << e.tag << "  "
-                << e.msg;
-            std::lock_guard<std::mutex> lk(m);
-            std::cout << os.str() << "\n";
-        }
-        else {
-            std::lock_guard<std::mutex> lk(m);
-            buf.push_back(std::move(e));
-        }
+    // "<time>  T<tid>  " prefix shared by immediate and deferred lines
+    void head(LineBuf& b, std::chrono::system_clock::time_point tp, int tid) const {
+        b.ts(tp).str("  ").ch('T').rnum((u64)(tid >= 0 ? tid : 0), w_tid, '0').str("  ");
     }
 
-    void run(const std::string& s) { add(-1, "RUN", s); }
-    void start(int tid, const std::string& s) { add(tid, "START", s); }
-    void prime(int tid, u64 n) { add(tid, "PRIME", "n=" + std::to_string(n)); }
-    void finish(int tid, const std::string& s) { add(tid, "FIN", s); }
+    template <class Body>
+    void emit(int tid, Tag tag, Body&& body) { emit_at(nowtp(), tid, tag, body); }
 
-    void line(const Ev& e, const std::string& body) {
-        std::ostringstream os;
-        os << std::left << std::setw(w_time) << ts_ms(e.tp) << "  "
-            << "T" << std::right << std::setw(w_tid) << std::setfill('0') << (e.tid >= 0 ? e.tid : 0)
-            << std::setfill(' ') << "  " << body;
-        std::cout << os.str() << "\n";
+    template <class Body>
+    void emit_at(std::chrono::system_clock::time_point tp, int tid, Tag tag, Body&& body) {
+        LineBuf& b = tls_line();
+        b.clear();
+        head(b, tp, tid);
+        b.lstr(tag_name(tag), w_tag).str("  ");
+        body(b);
+        b.ch('\n');
+        out_write(b);
     }
 
-    // A2: after compute, print in three blocks
-    void flush_deferred() {
-        std::lock_guard<std::mutex> lk(m);
-        std::vector<Ev> starts, fins, primes;
-        for (auto& e : buf) {
-            if (e.tag == "START") starts.push_back(e);
-            else if (e.tag == "FIN") fins.push_back(e);
-            else if (e.tag == "PRIME") primes.push_back(e);
-        }
-        auto by_tid_time = [](const Ev& a, const Ev& b) {
-            if (a.tid != b.tid) return a.tid < b.tid;
-            return a.tp < b.tp;
-            };
-        std::sort(starts.begin(), starts.end(), by_tid_time);
-        std::sort(fins.begin(), fins.end(), by_tid_time);
-        std::sort(primes.begin(), primes.end(), by_tid_time);
-
-        std::cout << "=== Thread Starts ===\n";
-        for (auto& e : starts) line(e, "Thread " + std::to_string(e.tid) + " started (" + e.msg + ")");
+    int gid(int tid) const { return tid >= 0 ? tid + tid_base : tid; }
 
-        std::cout << "\n=== Thread Finishes ===\n";
-        for (auto& e : fins)   line(e, "Thread " + std::to_string(e.tid) + " finished (" + e.msg + ")");
+    void add(int tid, Tag tag, std::string msg) {
+        if (!on(tag)) return;
+        tid = gid(tid);
+        if (tag == Tag::RUN && !run_prefix.empty()) msg = run_prefix + msg;
+        if (bin) bin->put(tid, tag, 0, &msg);
+        else if (mode == PrintMode::IMMEDIATE) {
+            emit(tid, tag, [&](LineBuf& b) { b.str(msg); });
+        }
+        else defer(Ev{ nowtp(), tid, tag, 0, std::move(msg) });
+    }
 
-        std::cout << "\n=== Results (Primes) ===\n";
-        for (auto& e : primes) line(e, "Thread " + std::to_string(e.tid) + " | Prime: " + e.msg.substr(2));
+    void run(const std::string& s) { add(-1, Tag::RUN, s); }
+    void start(int tid, const std::string& s) { add(tid, Tag::START, s); }
+    void finish(int tid, const std::string& s) { add(tid, Tag::FIN, s); }
+    void prime(int tid, u64 n) {
+        tid = gid(tid);
+        if (bin) bin->put(tid, Tag::PRIME, n, nullptr);
+        else if (mode == PrintMode::IMMEDIATE) {
+            emit(tid, Tag::PRIME, [&](LineBuf& b) { b.str("n=").num(n); });
+        }
+        else defer(Ev{ nowtp(), tid, Tag::PRIME, n, {} });
+    }
+    // text line under a numeric tag (sampling aggregates such as "primes in [x,y): k")
+    void note(int tid, Tag tag, std::string msg) {
+        tid = gid(tid);
+        if (bin) bin->put(tid, tag, 0, &msg);
+        else if (mode == PrintMode::IMMEDIATE) emit(tid, tag, [&](LineBuf& b) { b.str(msg); });
+        else defer(Ev{ nowtp(), tid, tag, 0, std::move(msg) });
+    }
+    void check(int tid, u64 n, u64 lim) {
+        tid = gid(tid);
+        if (bin) { bin->put(tid, Tag::CHECK, n, nullptr); return; }
+        emit(tid, Tag::CHECK, [&](LineBuf& b) { b.str("testing n=").num(n).str(" up to ").num(lim); });
+    }
 
-        buf.clear();
+    // immediate-layout line for a recorded event (binary decoder)
+    void replay(const Ev& e) {
+        emit_at(e.tp, e.tid, e.tag, [&](LineBuf& b) {
+            if (!e.msg.empty())           b.str(e.msg);
+            else if (e.tag == Tag::PRIME) b.str("n=").num(e.n);
+            else if (e.tag == Tag::CHECK) b.str("testing n=").num(e.n).str(" up to ").num((u64)std::sqrt((long double)e.n));
+            else                          b.str(e.msg);
+            });
     }
-};
 
-/* ---------- primality ---------- */
-static inline bool is_6kpm1(u64 d) { return (d % 6 == 1) || (d % 6 == 5); }
+    void line(LineBuf& b, const Ev& e) const {
+        head(b, e.tp, e.tid);
+        b.str("Thread ").num((u64)e.tid);
+        switch (e.tag) {
+        case Tag::START: b.str(" started (").str(e.msg).ch(')'); break;
+        case Tag::FIN:   b.str(" finished (").str(e.msg).ch(')'); break;
+        default:
+            if (e.msg.empty()) b.str(" | Prime: ").num(e.n);
+            else               b.str(" | ").str(e.msg);
+            break;
+        }
+        b.ch('\n');
+        out_spill(b);
+    }
 
-// B1 single-thread primality
-static bool prime_single(u64 n, const Config& c) {
-    if (n < 2) return false;
-    if (n == 2) return true;
-    if (c.skip_even && n % 2 == 0) return false;
+    // deferred layout order: START block, FIN block, PRIME block; each by tid then time
+    static int section(Tag t) { return t == Tag::START ? 0 : t == Tag::FIN ? 1 : 2; }
+    static bool deferred_before(const Ev& a, const Ev& b) {
+        int sa = section(a.tag), sb = section(b.tag);
+        if (sa != sb) return sa < sb;
+        if (a.tid != b.tid) return a.tid < b.tid;
+        return a.tp < b.tp;
+    }
 
-    u64 lim = (u64)std::sqrt((long double)n);
-    if (c.use_6k) {
-        for (u64 d = 3; d <= lim; ++d) {
-            if (!is_6kpm1(d)) continue;
-            if (n % d == 0) return false;
+    void defer(Ev&& e) {
+        if (e.tag == Tag::RUN || e.tag == Tag::CHECK) return;  // never shown in the deferred layout
+        std::lock_guard<std::mutex> lk(m);
+        buf_bytes += sizeof(Ev) + e.msg.size();
+        buf.push_back(std::move(e));
+        // spill in place, under the lock: loggers wait for the write, but only one buffer
+        // of about mem_limit bytes ever exists
+        if (mem_limit && buf_bytes >= mem_limit) {
+            spill(buf);
+            buf_bytes = 0;
         }
     }
-    else {
-        for (u64 d = 3; d <= lim; d += 2) {
-            if (n % d == 0) return false;
+
+    // run file record: rep tp, i32 tid, u8 tag, u64 n, u32 len, msg
+    template <class Next>
+    static bool write_run(const std::string& path, Next&& next) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        std::string rec;
+        while (const Ev* e = next()) {
+            put_raw(rec, e->tp.time_since_epoch().count());
+            put_raw<int>(rec, e->tid);
+            rec.push_back((char)e->tag);
+            put_raw<u64>(rec, e->n);
+            put_raw<unsigned>(rec, (unsigned)e->msg.size());
+            rec.append(e->msg);
+            if (rec.size() >= OUT_CHUNK) { out.write(rec.data(), (std::streamsize)rec.size()); rec.clear(); }
         }
+        out.write(rec.data(), (std::streamsize)rec.size());
+        return (bool)out;
     }
-    return true;
-}
 
-// B2: split divisors among T threads (no CHECK logs to keep it fast)
-static bool prime_parallel(u64 n, const Config& c, int T) {
-    if (n < 2) return false;
-    if (n == 2) return true;
-    if (c.skip_even && n % 2 == 0) return false;
-
-    u64 lim = (u64)std::sqrt((long double)n);
-    std::vector<u64> divs;
-    if (!c.skip_even) divs.push_back(2);
-    for (u64 d = 3; d <= lim; d += 2) {
-        if (c.use_6k && !is_6kpm1(d)) continue;
-        divs.push_back(d);
+    void spill(std::vector<Ev>& run) {
+        std::stable_sort(run.begin(), run.end(), deferred_before);
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lk(run_m);
+            path = temp_path(this, std::to_string(runs.size()) + ".run");
+            runs.push_back(path);
+        }
+        size_t i = 0;
+        if (!write_run(path, [&]() -> const Ev* { return i < run.size() ? &run[i++] : nullptr; }))
+            std::cerr << "WARN: failed writing spill file " << path << "\n";
+        run.clear();  // capacity stays for the next run (set_memory_limit reserved it)
     }
-    if (divs.empty()) return true;
 
-    std::atomic<bool> found(false);
-    std::vector<std::thread> ths; ths.reserve(T);
+    // procs>1 worker: spill what is buffered and give up the run files (the coordinator
+    // merges them with the other workers' runs into one deferred layout)
+    std::vector<std::string> hand_off() {
+        std::lock_guard<std::mutex> lk(m);
+        if (!buf.empty()) spill(buf);
+        buf_bytes = 0;
+        std::vector<std::string> out;
+        std::lock_guard<std::mutex> rk(run_m);
+        out.swap(runs);
+        return out;
+    }
 
-    auto worker = [&](int /*tid*/, size_t L, size_t R) {
-        for (size_t i = L; i < R && !found.load(std::memory_order_relaxed); ++i) {
-            if (n % divs[i] == 0) { found.store(true, std::memory_order_relaxed); break; }
+    struct RunReader {
+        std::ifstream in;
+        Ev cur{};
+        bool next() {
+            std::chrono::system_clock::duration::rep rep;
+            unsigned char tag;
+            unsigned len;
+            if (!in.read((char*)&rep, sizeof rep) || !in.read((char*)&cur.tid, sizeof cur.tid)
+                || !in.read((char*)&tag, 1) || !in.read((char*)&cur.n, sizeof cur.n)
+                || !in.read((char*)&len, sizeof len)) return false;
+            cur.tp = std::chrono::system_clock::time_point(std::chrono::system_clock::duration(rep));
+            cur.tag = (Tag)tag;
+            cur.msg.resize(len);
+            return len == 0 || (bool)in.read(&cur.msg[0], len);
         }
-        };
+    };
 
-    for (int t = 0; t < T; ++t) {
-        size_t L = (size_t)((divs.size() * 1ULL * t) / T);
-        size_t R = (size_t)((divs.size() * 1ULL * (t + 1)) / T);
-        ths.emplace_back(worker, t, L, R);
+    // A2: after compute, print in three blocks. `next` yields events in deferred_before
+    // order, from the sorted buffer or from the run-file merge.
+    template <class Next>
+    void print_sections(Next&& next) {
+        static const char* const heads[] = {
+            "=== Thread Starts ===\n", "\n=== Thread Finishes ===\n", "\n=== Results (Primes) ===\n" };
+        LineBuf& b = tls_line();
+        b.clear();
+        int sec = -1;
+        while (const Ev* e = next()) {
+            while (sec < section(e->tag)) b.str(heads[++sec]);
+            line(b, *e);
+        }
+        while (sec < 2) b.str(heads[++sec]);
+        out_spill(b, true);
     }
-    for (auto& th : ths) th.join();
-    return !found.load(std::memory_order_relaxed);
-}
 
-/* ---------- runs ---------- */
-struct Result {
-    std::vector<u64> primes;
+    void flush_deferred() {
+        std::lock_guard<std::mutex> lk(m);
+        if (runs.empty()) {
+            std::vector<const Ev*> evs;
+            evs.reserve(buf.size());
+            for (auto& e : buf) if (e.tag == Tag::START || e.tag == Tag::FIN || e.tag == Tag::PRIME) evs.push_back(&e);
+            // stable: events of one thread that share a timestamp (decoded logs have µs) keep their order
+            std::stable_sort(evs.begin(), evs.end(), [](const Ev* a, const Ev* b) { return deferred_before(*a, *b); });
+            size_t i = 0;
+            print_sections([&]() -> const Ev* { return i < evs.size() ? evs[i++] : nullptr; });
+            buf.clear();
+            return;
+        }
+
+        // external k-way merge over the spilled runs. Each merge holds one open file per
+        // run, so while there are more runs than that allows, groups of them are merged
+        // into longer runs first.
+        if (!buf.empty()) spill(buf);
+        buf_bytes = 0;
+        const size_t fan = merge_fan_in();
+        for (int pass = 0; runs.size() > fan; ++pass) {
+            std::vector<std::string> longer;
+            for (size_t a = 0; a < runs.size(); a += fan) {
+                const size_t b = std::min(runs.size(), a + fan);
+                if (b - a == 1) { longer.push_back(runs[a]); continue; }
+                const std::string path = temp_path(this, "p" + std::to_string(pass) + "_" + std::to_string(longer.size()) + ".run");
+                RunMerge mg(runs, a, b);
+                if (!write_run(path, [&] { return mg.next(); })) std::cerr << "WARN: failed writing spill file " << path << "\n";
+                for (size_t i = a; i < b; ++i) { std::error_code ec; std::filesystem::remove(runs[i], ec); }
+                longer.push_back(path);
+            }
+            runs.swap(longer);
+        }
+        {
+            RunMerge mg(runs, 0, runs.size());
+            print_sections([&] { return mg.next(); });
+        }
+        for (auto& f : runs) { std::error_code ec; std::filesystem::remove(f, ec); }
+        runs.clear();
+    }
+
+private:
+    // runs one merge may open: half the open-file limit, so sinks and sockets keep theirs
+    static size_t merge_fan_in() {
+        size_t fan = 1024;
+#if defined(_WIN32)
+        fan = std::min<size_t>(fan, (size_t)std::max(4, _getmaxstdio() / 2));
+#else
+        rlimit rl{};
+        if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+            fan = std::min<size_t>(fan, std::max<size_t>(4, (size_t)rl.rlim_cur / 2));
+#endif
+        return fan;
+    }
+
+    // k-way merge of files[a, b) in deferred_before order; ties go to the earlier run,
+    // which holds the earlier events. A run that can't be opened is reported, not skipped silently.
+    struct RunMerge {
+        std::vector<RunReader> rd;
+        std::vector<size_t> heap;
+        size_t top = SIZE_MAX;
+
+        RunMerge(const std::vector<std::string>& files, size_t a, size_t b) : rd(b - a) {
+            for (size_t i = 0; i < rd.size(); ++i) {
+                rd[i].in.open(files[a + i], std::ios::binary);
+                if (!rd[i].in) std::cerr << "WARN: can't open spill file " << files[a + i] << ", its events are missing\n";
+                else if (rd[i].next()) push(i);
+            }
+        }
+        bool later(size_t x, size_t y) const {
+            return deferred_before(rd[y].cur, rd[x].cur) || (!deferred_before(rd[x].cur, rd[y].cur) && x > y);
+        }
+        void push(size_t i) {
+            heap.push_back(i);
+            std::push_heap(heap.begin(), heap.end(), [this](size_t x, size_t y) { return later(x, y); });
+        }
+        const Ev* next() {
+            if (top != SIZE_MAX && rd[top].next()) push(top);
+            if (heap.empty()) return nullptr;
+            std::pop_heap(heap.begin(), heap.end(), [this](size_t x, size_t y) { return later(x, y); });
+            top = heap.back();
+            heap.pop_back();
+            return &rd[top].cur;
+        }
+    };
+};
+
+/* ---------- sampling ---------- */
+// Per-thread (B2: per-owner) filter in front of log.prime / log.check. State is local
+// to its worker, and the clock is only read when a decision actually depends on it.
+struct Sampler {
+    const SamplePolicy* p;
+    Tag tag;
+    u64 seen = 0, skip = 0;
+    double tokens = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    u64 agg_lo, agg_n = 0;
+
+    Sampler(const SamplePolicy& pol, Tag t, u64 lo) : p(&pol), tag(t), tokens((double)pol.arg), agg_lo(lo) {}
+
+    // true -> log this event as a normal line; aggregate mode writes its own summaries
+    bool take(Logger& log, int tid, u64 n) {
+        switch (p->kind) {
+        case Sample::ALL:
+            return true;
+        case Sample::EVERY:
+            return seen++ % p->arg == 0;
+        case Sample::RATE: {
+            if (tokens >= 1) { tokens -= 1; return true; }
+            if (skip) { --skip; return false; }
+            auto now = std::chrono::steady_clock::now();
+            tokens = std::min((double)p->arg,
+                tokens + std::chrono::duration<double>(now - t0).count() * (double)p->arg);
+            t0 = now;
+            if (tokens >= 1) { tokens -= 1; return true; }
+            skip = 63;  // bucket empty: don't poll the clock for the next few events
+            return false;
+        }
+        case Sample::AGGREGATE:
+            if ((++agg_n & 63) == 0 &&
+                std::chrono::steady_clock::now() - t0 >= std::chrono::milliseconds(p->arg)) emit(log, tid, n + 1);
+            return false;
+        }
+        return true;
+    }
+
+    // flush the open aggregate interval; `end` is one past the last number covered
+    void finish(Logger& log, int tid, u64 end) {
+        if (p->kind == Sample::AGGREGATE && agg_n) emit(log, tid, end);
+    }
+
+private:
+    void emit(Logger& log, int tid, u64 end) {
+        LineBuf b;
+        b.str(tag == Tag::PRIME ? "primes" : "checks").str(" in [").num(agg_lo).ch(',').num(end).str("): ").num(agg_n);
+        log.note(tid, tag, std::move(b.s));
+        agg_lo = end;
+        agg_n = 0;
+        t0 = std::chrono::steady_clock::now();
+    }
+};
+
+/* ---------- placement ---------- */
+// affinity=compact fills one NUMA node (SMT siblings adjacent) before the next; scatter
+// deals threads round-robin over nodes, one per core before any sibling. Topology comes
+// from /sys (no libnuma). A pinned worker allocates its own buffers after pinning, so the
+// kernel's first-touch policy puts them on the worker's node.
+struct CpuInfo { int cpu = 0, node = 0, pkg = 0, core = 0; };
+
+static std::vector<int> parse_cpu_list(const std::string& s) {
+    std::vector<int> v;
+    std::stringstream ss(s);
+    std::string part;
+    while (std::getline(ss, part, ',')) {
+        part = trim(part);
+        if (part.empty()) continue;
+        auto dash = part.find('-');
+        int a = std::stoi(part.substr(0, dash));
+        int b = (dash == std::string::npos) ? a : std::stoi(part.substr(dash + 1));
+        for (int i = a; i <= b; ++i) v.push_back(i);
+    }
+    return v;
+}
+
+static std::vector<CpuInfo> read_topology() {
+    std::vector<CpuInfo> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof set, &set) != 0) return cpus;
+    auto read_int = [](const std::string& path, int dflt) {
+        std::ifstream in(path);
+        int v;
+        return (in >> v) ? v : dflt;
+        };
+    std::vector<int> node_of(CPU_SETSIZE, 0);
+    std::error_code ec;
+    for (auto& e : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+        const std::string name = e.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::isdigit((unsigned char)name[4])) continue;
+        std::ifstream in(e.path() / "cpulist");
+        std::string list;
+        if (!std::getline(in, list)) continue;
+        for (int cpu : parse_cpu_list(list)) if (cpu >= 0 && cpu < CPU_SETSIZE) node_of[cpu] = std::stoi(name.substr(4));
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        cpus.push_back({ cpu, node_of[cpu], read_int(dir + "physical_package_id", 0), read_int(dir + "core_id", cpu) });
+    }
+#else
+    const int n = (int)std::max(1u, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < n; ++cpu) cpus.push_back({ cpu, 0, 0, cpu });
+#endif
+    return cpus;
+}
+
+// CPUs the cgroup quota allows (cpu.max on v2, cfs_quota_us/cfs_period_us on v1), rounded
+// up; 0 = no quota. Nested v2 groups are walked to the root and the tightest limit wins.
+static int cgroup_cpu_limit() {
+    int best = 0;
+#if defined(__linux__)
+    auto take = [&](double quota, double period) {
+        if (quota <= 0 || period <= 0) return;
+        const int n = std::max(1, (int)std::ceil(quota / period));
+        if (!best || n < best) best = n;
+        };
+    std::ifstream cg("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cg, line)) {
+        const auto a = line.find(':'), b = line.find(':', a + 1);
+        if (a == std::string::npos || b == std::string::npos) continue;
+        const std::string ctrl = line.substr(a + 1, b - a - 1);
+        std::filesystem::path rel = line.substr(b + 1);
+        if (line.compare(0, 2, "0:") == 0 && ctrl.empty()) {
+            std::filesystem::path dir = "/sys/fs/cgroup";
+            if (!rel.relative_path().empty()) dir /= rel.relative_path();
+            for (;; dir = dir.parent_path()) {
+                std::ifstream in(dir / "cpu.max");
+                std::string q;
+                double period = 0;
+                if (in >> q >> period && q != "max") take(std::stod(q), period);
+                if (dir == "/sys/fs/cgroup" || !dir.has_relative_path()) break;
+            }
+        }
+        else if (ctrl.find("cpu") != std::string::npos && ctrl.find("cpuset") == std::string::npos) {
+            // Walk up to the mount root as for v2. Without a cgroup namespace the path is the
+            // host's (/docker/<id>), while the container sees its own cgroup at the root.
+            for (const char* mount : { "/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpu" }) {
+                std::error_code ec;
+                if (!std::filesystem::is_directory(mount, ec)) continue;
+                std::filesystem::path dir = mount;
+                if (!rel.relative_path().empty()) dir /= rel.relative_path();
+                for (;; dir = dir.parent_path()) {
+                    std::ifstream qf(dir / "cpu.cfs_quota_us"), pf(dir / "cpu.cfs_period_us");
+                    double quota = 0, period = 0;
+                    if (qf >> quota && pf >> period) take(quota, period);
+                    if (dir == mount || !dir.has_relative_path()) break;
+                }
+                break;
+            }
+        }
+    }
+#endif
+    return best;
+}
+
+// threads=auto: min(hardware_concurrency, CPUs in the affinity mask, cgroup quota), counting
+// physical cores instead of hardware threads with smt=0. `why` describes the inputs.
+static int detect_threads(bool smt, std::string& why) {
+    const int hw = (int)std::thread::hardware_concurrency();
+    int allowed = 0, cores = 0;
+#if defined(_WIN32)
+    DWORD_PTR proc = 0, sys = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &proc, &sys))
+        for (; proc; proc &= proc - 1) ++allowed;
+    DWORD len = 0;
+    GetLogicalProcessorInformation(nullptr, &len);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!info.empty() && GetLogicalProcessorInformation(info.data(), &len))
+        for (auto& e : info) if (e.Relationship == RelationProcessorCore) ++cores;
+#else
+    std::vector<CpuInfo> cpus = read_topology();
+    allowed = (int)cpus.size();
+    std::vector<std::pair<int, int>> seen;
+    for (auto& ci : cpus) seen.emplace_back(ci.pkg, ci.core);
+    std::sort(seen.begin(), seen.end());
+    cores = (int)(std::unique(seen.begin(), seen.end()) - seen.begin());
+#endif
+    const int quota = cgroup_cpu_limit();
+    int n = hw > 0 ? hw : 1;
+    if (allowed > 0) n = std::min(n, allowed);
+    if (!smt && cores > 0) n = std::min(n, cores);
+    if (quota > 0) n = std::min(n, quota);
+    std::ostringstream os;
+    os << "hw=" << hw << " allowed=" << allowed << " cores=" << cores << " quota=" << (quota ? std::to_string(quota) : "none");
+    why = os.str();
+    return std::max(1, n);
+}
+
+// CPU order for the affinity policy; empty = don't pin
+static std::vector<int> resolve_affinity(const std::string& policy) {
+    if (policy != "compact" && policy != "scatter" && policy.rfind("list:", 0) != 0) return {};
+    std::vector<CpuInfo> cpus = read_topology();
+    if (policy[0] == 'l') {
+        // keep listed CPUs this process may run on, in the given order
+        std::vector<int> order;
+        for (int cpu : parse_cpu_list(policy.substr(5)))
+            if (std::any_of(cpus.begin(), cpus.end(), [&](const CpuInfo& ci) { return ci.cpu == cpu; })) order.push_back(cpu);
+        return order;
+    }
+    auto key = [](const CpuInfo& a) { return std::make_tuple(a.node, a.pkg, a.core, a.cpu); };
+    std::sort(cpus.begin(), cpus.end(), [&](const CpuInfo& a, const CpuInfo& b) { return key(a) < key(b); });
+    std::vector<int> order;
+    if (policy == "compact") {
+        for (auto& ci : cpus) order.push_back(ci.cpu);
+        return order;
+    }
+    // scatter: per node, first hardware thread of every core, then the second, ...
+    std::vector<std::vector<int>> per_node;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j < cpus.size() && cpus[j].node == cpus[i].node) ++j;
+        std::vector<std::vector<int>> by_rank;
+        for (size_t k = i; k < j; ++k) {
+            size_t rank = 0;
+            while (k > i + rank && cpus[k - rank - 1].pkg == cpus[k].pkg && cpus[k - rank - 1].core == cpus[k].core) ++rank;
+            if (by_rank.size() <= rank) by_rank.resize(rank + 1);
+            by_rank[rank].push_back(cpus[k].cpu);
+        }
+        per_node.emplace_back();
+        for (auto& r : by_rank) per_node.back().insert(per_node.back().end(), r.begin(), r.end());
+        i = j;
+    }
+    for (size_t k = 0; order.size() < cpus.size(); ++k)
+        for (auto& nv : per_node) if (k < nv.size()) order.push_back(nv[k]);
+    return order;
+}
+
+// pins the calling thread to worker slot t's CPU (no-op with affinity=none)
+static void pin_worker(const Config& c, int t) {
+    if (c.pin_cpus.empty()) return;
+    const int cpu = c.pin_cpus[(size_t)t % c.pin_cpus.size()];
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof set, &set);
+#elif defined(_WIN32)
+    if (cpu < 64) SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+/* ---------- per-thread stats ---------- */
+// One cache line per thread, so neighbouring threads' counters never share a line. A
+// worker fills only its own block; runs reduce the blocks into Result once at the end.
+#if defined(__cpp_lib_hardware_interference_size)
+static constexpr size_t CACHE_LINE = std::hardware_destructive_interference_size;
+#else
+static constexpr size_t CACHE_LINE = 64;
+#endif
+
+struct alignas(CACHE_LINE) ThreadStats {
+    u64 processed = 0, primes = 0;
+    u64 divisions = 0;  // trial divisions performed
+    u64 busy_ns = 0;    // time spent testing, waits excluded
+};
+using Stats = std::vector<ThreadStats>;
+
+static u64 ns_since(std::chrono::steady_clock::time_point t0) {
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+/* ---------- primality ---------- */
+static inline bool is_6kpm1(u64 d) { return (d % 6 == 1) || (d % 6 == 5); }
+
+// B1 single-thread primality; adds the trial divisions it made to `divs`
+static bool prime_single(u64 n, const Config& c, u64& divs) {
+    if (n < 2) return false;
+    if (n == 2) return true;
+    if (c.skip_even && n % 2 == 0) return false;
+
+    u64 lim = (u64)std::sqrt((long double)n);
+    if (c.use_6k) {
+        for (u64 d = 3; d <= lim; ++d) {
+            if (!is_6kpm1(d)) continue;
+            ++divs;
+            if (n % d == 0) return false;
+        }
+    }
+    else {
+        for (u64 d = 3; d <= lim; d += 2) {
+            ++divs;
+            if (n % d == 0) return false;
+        }
+    }
+    return true;
+}
+
+// Divisors are dealt out a cache line at a time (8 u64s), block b to thread b % T, so
+// every thread starts on small divisors, which catch most composites. The stop flag is
+// read once per block.
+static constexpr size_t DIV_BLOCK = CACHE_LINE / sizeof(u64);
+
+// B2: split divisors among T threads (no CHECK logs to keep it fast). Worker t adds its
+// divisions and busy time to st[t]; the caller's first block counts for worker 0.
+static bool prime_parallel(u64 n, const Config& c, int T, Stats& st) {
+    if (n < 2) return false;
+    if (n == 2) return true;
+    if (c.skip_even && n % 2 == 0) return false;
+
+    u64 lim = (u64)std::sqrt((long double)n);
+    std::vector<u64> divs;
+    if (!c.skip_even) divs.push_back(2);
+    for (u64 d = 3; d <= lim; d += 2) {
+        if (c.use_6k && !is_6kpm1(d)) continue;
+        divs.push_back(d);
+    }
+    if (divs.empty()) return true;
+
+    // first block on the caller: most composites end here, before any thread is started
+    const size_t head = std::min(divs.size(), DIV_BLOCK);
+    for (size_t i = 0; i < head; ++i) if (n % divs[i] == 0) { st[0].divisions += i + 1; return false; }
+    st[0].divisions += head;
+    if (head == divs.size()) return true;
+
+    std::atomic<bool> found(false);
+    std::vector<std::thread> ths; ths.reserve(T);
+
+    auto worker = [&](int tid) {
+        pin_worker(c, tid);
+        const auto t0 = std::chrono::steady_clock::now();
+        u64 k = 0;
+        for (size_t b = head + (size_t)tid * DIV_BLOCK; b < divs.size() && !found.load(std::memory_order_relaxed); b += (size_t)T * DIV_BLOCK) {
+            const size_t e = std::min(divs.size(), b + DIV_BLOCK);
+            size_t i = b;
+            while (i < e && n % divs[i] != 0) ++i;
+            k += std::min(e, i + 1) - b;
+            if (i < e) { found.store(true, std::memory_order_relaxed); break; }
+        }
+        st[tid].divisions += k;
+        st[tid].busy_ns += ns_since(t0);
+        };
+
+    for (int t = 0; t < T; ++t) ths.emplace_back(worker, t);
+    for (auto& th : ths) th.join();
+    return !found.load(std::memory_order_relaxed);
+}
+
+// B2 batch=K: K candidates share one pass over the divisors. Thread t takes every T-th
+// block of DIV_BLOCK odd divisors up to sqrt(hi) and strikes every candidate it divides.
+struct DivisorBlock {
+    u64 lo = 0, hi = 0;            // numbers covered, skipped evens included
+    u64 skipped = 0;               // ...of which skip_even dropped this many
+    std::vector<u64> n;
+    std::vector<int> owner;
+    std::unique_ptr<std::atomic<bool>[]> composite;
+
+    explicit DivisorBlock(size_t k) : composite(new std::atomic<bool>[k]) { for (size_t i = 0; i < k; ++i) composite[i] = false; }
+
+    // returns the trial divisions made
+    u64 test_slice(const Config& c, int t, int T) {
+        const u64 step = 2 * DIV_BLOCK * (u64)T;
+        u64 k = 0;
+        for (size_t i = 0; i < n.size(); ++i) {
+            const u64 x = n[i];
+            if (t == 0 && !c.skip_even && x > 2 && x % 2 == 0) { composite[i].store(true, std::memory_order_relaxed); continue; }
+            const u64 top = (u64)std::sqrt((long double)x) + 1;  // exclusive
+            for (u64 d0 = 3 + 2 * DIV_BLOCK * (u64)t; d0 < top && !composite[i].load(std::memory_order_relaxed); d0 += step) {
+                const u64 e = std::min(top, d0 + 2 * DIV_BLOCK);
+                for (u64 d = d0; d < e; d += 2) {
+                    if (c.use_6k && !is_6kpm1(d)) continue;
+                    ++k;
+                    if (x % d == 0) { composite[i].store(true, std::memory_order_relaxed); break; }
+                }
+            }
+        }
+        return k;
+    }
+};
+
+/* ---------- sync ---------- */
+// Reusable barrier (C++17 has no std::barrier). The last thread to arrive runs `done`
+// before anyone is released, like std::barrier's completion step.
+struct Barrier {
+    std::mutex m;
+    std::condition_variable cv;
+    int n, waiting = 0;
+    u64 gen = 0;
+
+    explicit Barrier(int count) : n(count) {}
+
+    template <class F>
+    void wait(F&& done) {
+        std::unique_lock<std::mutex> lk(m);
+        u64 g = gen;
+        if (++waiting == n) {
+            done();
+            waiting = 0;
+            ++gen;
+            cv.notify_all();
+            return;
+        }
+        cv.wait(lk, [&] { return gen != g; });
+    }
+    void wait() { wait([] {}); }
+};
+
+// Bounded single-producer/single-consumer ring. push/pop never block; callers back off
+// (Backoff) while a ring is full or empty. The producer close()s after its last push.
+template <class T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t cap) {
+        size_t n = 2;
+        while (n < cap + 1) n <<= 1;
+        slots.resize(n);
+        mask = n - 1;
+    }
+    bool push(T&& v) {
+        const size_t t = tail.load(std::memory_order_relaxed), nt = (t + 1) & mask;
+        if (nt == head.load(std::memory_order_acquire)) return false;
+        slots[t] = std::move(v);
+        tail.store(nt, std::memory_order_release);
+        return true;
+    }
+    bool pop(T& v) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        v = std::move(slots[h]);
+        head.store((h + 1) & mask, std::memory_order_release);
+        return true;
+    }
+    void close() { closed.store(true, std::memory_order_release); }
+    // consumer side: closed and drained
+    bool done() const { return closed.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+    std::vector<T> slots;
+    size_t mask = 0;
+    alignas(CACHE_LINE) std::atomic<size_t> head{ 0 };
+    alignas(CACHE_LINE) std::atomic<size_t> tail{ 0 };
+    std::atomic<bool> closed{ false };
+};
+
+// spin politely, then sleep, so idle stages don't steal cores from compute
+struct Backoff {
+    int n = 0;
+    void pause() {
+        if (++n < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    void reset() { n = 0; }
+};
+
+/* ---------- compact prime store ---------- */
+// Primes as byte gaps: halved even gaps 1..255 take one byte, anything else (the 2->3 step,
+// gaps > 510) is 0x00 followed by a varint gap. Every K-th prime is kept as an absolute
+// checkpoint with its byte offset, giving O(K) random access and ~1.06 bytes per prime.
+struct GapStore {
+    static constexpr u64 K = 256;
+
+    std::vector<unsigned char> bytes;  // gap of prime i (i >= 1) to prime i-1
+    std::vector<u64> cp_val, cp_off;   // prime #jK and the offset of the gap that follows it
+    u64 n = 0, last = 0;
+
+    // one contiguous run of primes, encoded independently (B1 workers, in parallel)
+    struct Part { std::vector<unsigned char> bytes; std::vector<u64> cp_val, cp_off; };
+
+    static void put_gap(std::vector<unsigned char>& o, u64 g) {
+        if ((g & 1) == 0 && g >= 2 && g <= 510) { o.push_back((unsigned char)(g >> 1)); return; }
+        o.push_back(0);
+        while (g >= 0x80) { o.push_back((unsigned char)(g | 0x80)); g >>= 7; }
+        o.push_back((unsigned char)g);
+    }
+    static u64 get_gap(const unsigned char* b, size_t& off) {
+        unsigned char h = b[off++];
+        if (h) return (u64)h << 1;
+        u64 g = 0;
+        for (int sh = 0;; sh += 7) {
+            unsigned char x = b[off++];
+            g |= (u64)(x & 0x7f) << sh;
+            if (!(x & 0x80)) return g;
+        }
+    }
+
+    // p[0..cnt) are global primes #first_idx.., `prev` is prime #first_idx-1 (if any)
+    static Part encode(const u64* p, size_t cnt, u64 first_idx, u64 prev) {
+        Part part;
+        part.bytes.reserve(cnt + cnt / 64);
+        for (size_t i = 0; i < cnt; ++i) {
+            u64 idx = first_idx + i;
+            if (idx > 0) put_gap(part.bytes, p[i] - prev);
+            if (idx % K == 0) { part.cp_val.push_back(p[i]); part.cp_off.push_back(part.bytes.size()); }
+            prev = p[i];
+        }
+        return part;
+    }
+
+    // size for `count` primes / `total` gap bytes, then place() every part (any thread order)
+    void assemble(u64 count, size_t total, u64 last_prime) {
+        n = count;
+        last = last_prime;
+        bytes.resize(total);
+        cp_val.resize((size_t)((n + K - 1) / K));
+        cp_off.resize(cp_val.size());
+    }
+    void place(const Part& part, u64 first_idx, size_t byte_off) {
+        std::copy(part.bytes.begin(), part.bytes.end(), bytes.begin() + (ptrdiff_t)byte_off);
+        size_t j = (size_t)((first_idx + K - 1) / K);
+        for (size_t i = 0; i < part.cp_val.size(); ++i) {
+            cp_val[j + i] = part.cp_val[i];
+            cp_off[j + i] = part.cp_off[i] + byte_off;
+        }
+    }
+
+    void push_back(u64 p) {
+        if (n > 0) put_gap(bytes, p - last);
+        if (n % K == 0) { cp_val.push_back(p); cp_off.push_back(bytes.size()); }
+        last = p;
+        ++n;
+    }
+
+    u64 size() const { return n; }
+    bool empty() const { return n == 0; }
+    size_t memory() const { return bytes.capacity() + (cp_val.capacity() + cp_off.capacity()) * sizeof(u64); }
+
+    u64 operator[](u64 i) const {
+        u64 v = cp_val[(size_t)(i / K)];
+        size_t off = (size_t)cp_off[(size_t)(i / K)];
+        for (u64 s = i % K; s; --s) v += get_gap(bytes.data(), off);
+        return v;
+    }
+
+    struct const_iterator {
+        const GapStore* s;
+        u64 i, v;
+        size_t off;
+        u64 operator*() const { return v; }
+        const_iterator& operator++() {
+            if (++i < s->n) v += get_gap(s->bytes.data(), off);
+            return *this;
+        }
+        bool operator!=(const const_iterator& o) const { return i != o.i; }
+    };
+    const_iterator begin() const { return { this, 0, n ? cp_val[0] : 0, n ? (size_t)cp_off[0] : 0 }; }
+    const_iterator from(u64 i) const {
+        if (i >= n) return end();
+        const_iterator it{ this, i - i % K, cp_val[(size_t)(i / K)], (size_t)cp_off[(size_t)(i / K)] };
+        while (it.i < i) ++it;
+        return it;
+    }
+    const_iterator end() const { return { this, n, 0, 0 }; }
+};
+
+/* ---------- result sinks ---------- */
+// result=stream: primes are handed over chunk by chunk instead of collected.
+// Calls may come from several workers at once. Each lane (B1: tid, B2: 0) delivers in
+// ascending order, and lanes themselves ascend, so lane-ordered concatenation is sorted.
+struct PrimeSink {
+    virtual ~PrimeSink() = default;
+    virtual void consume(int lane, const u64* p, size_t n) = 0;
+    virtual void close() {}
+};
+
+struct CountSink : PrimeSink {
+    std::atomic<u64> count{ 0 };
+    void consume(int, const u64*, size_t n) override { count.fetch_add(n, std::memory_order_relaxed); }
+};
+
+struct SumSink : PrimeSink {
+    std::atomic<u64> sum{ 0 };
+    void consume(int, const u64* p, size_t n) override {
+        u64 s = 0;
+        for (size_t i = 0; i < n; ++i) s += p[i];
+        sum.fetch_add(s, std::memory_order_relaxed);
+    }
+};
+
+// Decimal primes, each followed by `sep`. Every lane spools to its own part file, and
+// close() concatenates the parts in lane order into `path` (sorted, nothing held in RAM).
+// With async_bytes > 0 each lane writes its part through an AsyncWriter instead.
+struct FileSink : PrimeSink {
+    struct Lane { LineBuf b; std::ofstream part; std::unique_ptr<AsyncWriter> aw; std::string path; };
+    std::string path;
+    char sep;
+    std::vector<Lane> lanes;
+
+    FileSink(std::string out, int n_lanes, char separator, size_t async_bytes = 0, int async_n = 3)
+        : path(std::move(out)), sep(separator), lanes(n_lanes) {
+        for (int i = 0; i < n_lanes; ++i) {
+            Lane& l = lanes[i];
+            l.path = temp_path(this, "lane" + std::to_string(i) + ".part");
+            if (async_bytes) {
+                l.aw.reset(new AsyncWriter(async_bytes, async_n));
+                if (l.aw->open_path(l.path)) continue;
+                l.aw.reset();
+            }
+            l.part.open(l.path, std::ios::binary | std::ios::trunc);
+        }
+    }
+    ~FileSink() override { for (auto& l : lanes) { std::error_code ec; std::filesystem::remove(l.path, ec); } }
+
+    void consume(int lane, const u64* p, size_t n) override {
+        Lane& l = lanes[lane];
+        for (size_t i = 0; i < n; ++i) {
+            l.b.num(p[i]).ch(sep);
+            if (l.b.size() >= OUT_CHUNK) drain(l);
+        }
+    }
+    static void drain(Lane& l) {
+        if (l.aw) l.aw->write(l.b.s.data(), l.b.size());
+        else l.part.write(l.b.s.data(), (std::streamsize)l.b.size());
+        l.b.clear();
+    }
+
+    void close() override {
+        for (auto& l : lanes) {
+            drain(l);
+            if (l.aw) l.aw->close();
+            else l.part.close();
+        }
+        if (path.empty()) return;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        for (auto& l : lanes) {
+            std::ifstream in(l.path, std::ios::binary);
+            if (in.peek() != std::ifstream::traits_type::eof()) out << in.rdbuf();
+        }
+        if (!out) std::cerr << "WARN: failed writing " << path << "\n";
+    }
+
+    // list_primes for stream mode: parts straight to stdout, the last separator becomes '\n'
+    bool dump_stdout() {
+        LineBuf& b = tls_line();
+        bool any = false;
+        if (g_async_out && g_async_out->splicing()) {
+            // zero_copy: splice the parts into the pipe, holding back the final separator
+            std::vector<u64> sz(lanes.size());
+            size_t last = lanes.size();
+            for (size_t i = 0; i < lanes.size(); ++i) {
+                std::error_code ec;
+                sz[i] = std::filesystem::file_size(lanes[i].path, ec);
+                if (ec) sz[i] = 0;
+                if (sz[i]) last = i;
+            }
+            if (last == lanes.size()) return false;
+            b.str("\nPrimes:\n");
+            out_spill(b, true);
+            bool ok = true;
+            for (size_t i = 0; i <= last && ok; ++i)
+                if (sz[i]) ok = g_async_out->send_file(lanes[i].path, i == last ? sz[i] - 1 : sz[i]);
+            if (ok) { b.ch('\n'); out_spill(b, true); return true; }
+            std::cerr << "WARN: splice failed, primes list truncated\n";
+            return true;
+        }
+        for (auto& l : lanes) {
+            std::ifstream in(l.path, std::ios::binary);
+            char tmp[1 << 16];
+            while (in.read(tmp, sizeof tmp) || in.gcount() > 0) {
+                if (!any) { b.str("\nPrimes:\n"); any = true; }
+                b.str(tmp, (size_t)in.gcount());
+                if (b.size() >= OUT_CHUNK) {
+                    // hold back the last byte: it may be the final separator, which becomes '\n'
+                    const char last = b.s.back();
+                    b.s.pop_back();
+                    out_spill(b, true);
+                    b.ch(last);
+                }
+            }
+        }
+        if (any) { b.s.back() = '\n'; out_spill(b, true); }
+        return any;
+    }
+};
+
+struct SinkSet {
+    std::vector<PrimeSink*> v;
+    int lane_base = 0;  // adaptive: the divisor-split phase delivers after the T range lanes
+    void consume(int lane, const std::vector<u64>& p) { if (!p.empty()) for (auto* s : v) s->consume(lane_base + lane, p.data(), p.size()); }
+    void close() { for (auto* s : v) s->close(); }
+};
+
+/* ---------- checkpoint ---------- */
+// checkpoint_file: a background thread rewrites the progress table every checkpoint_ms
+// (temp + rename, so the file is always whole). Workers publish once per segment, which
+// is one uncontended lock per `segment` numbers. Slots: B1 one per thread; B2 slot 0 is
+// the number loop and slot 1+o is owner o. `next` is the first number not yet done.
+struct Progress { u64 next = 0, processed = 0, primes = 0; };
+
+struct Checkpoint {
+    std::string path, run;          // `run` identifies the job; resume only if it matches
+    std::vector<Progress> slots;
+    bool resumed = false;
+    bool range_slots = false;
+    u64 restored = 0;               // load(): primes found before the resume (result=stream adds them)
+    std::mutex m;
+    std::condition_variable cv;
+    bool stop = false;
+    std::thread th;
+
+    Checkpoint(std::string file, const Config& c, size_t n_slots) : path(std::move(file)), slots(n_slots) {
+        std::ostringstream os;
+        os << "max_value:" << c.max_value << ",threads:" << c.threads << ",division:" << c.division
+            << ",skip_even:" << c.skip_even << ",use_6k:" << c.use_6k << ",start_after:" << c.start_after;
+        run = os.str();
+        range_slots = c.division == "range";
+    }
+
+    bool load() {
+        std::ifstream in(path);
+        std::string line;
+        if (!std::getline(in, line) || line != "run=" + run) return false;
+        std::vector<Progress> got(slots.size());
+        size_t seen = 0;
+        while (std::getline(in, line)) {
+            size_t i;
+            Progress p;
+            std::istringstream ls(line);
+            char eq;
+            if (line.compare(0, 4, "slot") != 0) continue;
+            ls.ignore(4);
+            if (!(ls >> i >> eq >> p.next >> p.processed >> p.primes) || eq != '=' || i >= got.size()) return false;
+            got[i] = p;
+            ++seen;
+        }
+        if (seen != slots.size()) return false;
+        slots = std::move(got);
+        resumed = true;
+        // primes counted before the resume: B1 has one slot per thread, B2's slot 0 holds the totals
+        for (size_t i = 0; i < slots.size(); ++i) if (range_slots || i == 0) restored += slots[i].primes;
+        return true;
+    }
+
+    void publish(size_t i, const Progress& p) {
+        std::lock_guard<std::mutex> lk(m);
+        slots[i] = p;
+    }
+
+    bool write() {
+        std::ostringstream os;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            os << "run=" << run << "\n";
+            for (size_t i = 0; i < slots.size(); ++i)
+                os << "slot" << i << "=" << slots[i].next << " " << slots[i].processed << " " << slots[i].primes << "\n";
+        }
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << os.str();
+            if (!out) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        return !ec;
+    }
+
+    void start(u64 every_ms) {
+        th = std::thread([this, every_ms] {
+            std::unique_lock<std::mutex> lk(m);
+            while (!cv.wait_for(lk, std::chrono::milliseconds(every_ms), [&] { return stop; })) {
+                lk.unlock();
+                if (!write()) std::cerr << "WARN: can't write checkpoint " << path << "\n";
+                lk.lock();
+            }
+            });
+    }
+
+    // a completed run drops the file (an interrupted one keeps the last periodic snapshot)
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stop = true;
+        }
+        cv.notify_all();
+        if (th.joinable()) th.join();
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+};
+
+/* ---------- runs ---------- */
+// B1 slice of thread t: (start_after, max_value] split evenly, never below 2
+static std::pair<u64, u64> thread_range(const Config& c, int t) {
+    const int T = std::max(1, c.threads);
+    const u64 base = std::min(c.start_after, c.max_value);
+    const u64 span = c.max_value - base;
+    u64 lo = base + (span * 1ULL * t) / T + 1;
+    u64 hi = base + (span * 1ULL * (t + 1)) / T;
+    if (lo < 2) lo = 2;
+    return { lo,hi };
+}
+
+// procs>1: config of worker process k, whose slice of (start_after, max_value] is split
+// the same way thread_range splits it between threads
+static Config proc_config(const Config& c, int k) {
+    Config s = c;
+    const u64 base = std::min(c.start_after, c.max_value);
+    const u64 span = c.max_value - base;
+    s.start_after = base + (span * 1ULL * k) / c.procs;
+    s.max_value = base + (span * 1ULL * (k + 1)) / c.procs;
+    s.procs = 1;
+    return s;
+}
+
+struct Result {
+    std::vector<u64> primes;      // result=store, prime_store=vector
+    GapStore packed;              // result=store, prime_store=gaps
     u64 processed = 0;
+    u64 prime_count = 0;
+    u64 prime_sum = 0;            // result=stream only (SumSink)
+    u64 cached_upto = 0;          // cache_file: [2, cached_upto] came from the cache...
+    u64 cached_primes = 0;        // ...holding this many primes (not in prime_count)
     std::vector<u64> primes_per_thread;
     std::vector<u64> proc_per_thread;
+    std::vector<u64> divisions_per_thread;
+    std::vector<u64> busy_ns_per_thread;
+    bool analytics = false;       // pipeline=1: the analytics stage filled prime_sum and these
+    u64 max_gap = 0, max_gap_after = 0;
+    u64 checksum = 0;             // order-independent: sum of mix(p) over all primes
+    u64 crossover = 0;            // division=adaptive: [crossover, max] went to divisor splitting...
+    std::vector<u64> split_per_thread;  // ...and these are each thread's numbers from it
+    std::vector<std::string> row_labels;  // serve: table rows are workers (these labels), not threads
+    u64 leases = 0, leases_again = 0;     // serve: chunks, and how many were leased more than once
+    bool resumed = false;         // checkpoint resume: earlier primes are counted, but not listed or summed
 };
 
+// per-thread columns of Result from the stats blocks (totals are up to the run)
+static void reduce_stats(Result& r, const Stats& st) {
+    r.proc_per_thread.clear(); r.primes_per_thread.clear();
+    r.divisions_per_thread.clear(); r.busy_ns_per_thread.clear();
+    for (const ThreadStats& s : st) {
+        r.proc_per_thread.push_back(s.processed);
+        r.primes_per_thread.push_back(s.primes);
+        r.divisions_per_thread.push_back(s.divisions);
+        r.busy_ns_per_thread.push_back(s.busy_ns);
+    }
+}
+
 // B1: contiguous numeric ranges per thread
-static Result run_B1(const Config& c, Logger& log) {
+template <class LP>
+static Result run_B1(const Config& c, Logger& log, SinkSet* sinks, Checkpoint* ck) {
     Result r;
     const int T = std::max(1, c.threads);
     u64 N = c.max_value;
-    r.primes_per_thread.assign(T, 0);
-    r.proc_per_thread.assign(T, 0);
+    Stats st(T);
 
     log.run("Variant=A" + std::string(c.printing == "immediate" ? "1" : "2") + "B1  threads=" + std::to_string(T) + "  max=" + std::to_string(N));
 
-    auto chunk = [&](int t)->std::pair<u64, u64> {
-        u64 lo = (N * 1ULL * t) / T + 1;
-        u64 hi = (N * 1ULL * (t + 1)) / T;
-        if (lo < 2) lo = 2;
-        return { lo,hi };
-        };
+    auto chunk = [&](int t) { return thread_range(c, t); };
 
-    std::mutex mx;
+    // ranges ascend with tid, so placing each thread's block at the exclusive prefix sum
+    // of the counts yields a sorted r.primes without a lock or a re-sort
+    // (prime_store=gaps: same placement, plus a second prefix sum over encoded byte sizes)
+    const bool gaps = !sinks && c.prime_store == "gaps";
+    std::vector<u64> offset(T + 1, 0), last(T, 0), byte_off(T + 1, 0), kept(T, 0);
+    Barrier counted(T), encoded(T);
     std::vector<std::thread> ths; ths.reserve(T);
 
     for (int tid = 0; tid < T; ++tid) {
         auto [lo, hi] = chunk(tid);
         ths.emplace_back([&, tid, lo, hi] {
+            pin_worker(c, tid);
             {
                 std::ostringstream os; os << "range=[" << lo << "-" << hi << "]";
                 log.start(tid, os.str());
             }
             std::vector<u64> mine;
-            u64 done = 0;
-
-            for (u64 n = lo; n <= hi; ++n) {
-                // optional CHECKs only for B1+immediate (if log_every>=0)
-                if (c.printing == "immediate" && c.log_every >= 0) {
-                    if (c.log_every == 0 || (done % c.log_every) == 0) {
-                        u64 lim = (u64)std::sqrt((long double)n);
-                        std::ostringstream os; os << "testing n=" << n << " up to " << lim;
-                        log.add(tid, "CHECK", os.str());
+            u64 done = 0, found = 0, divs = 0, from = lo;
+            if (ck && ck->resumed && ck->slots[tid].next) {
+                from = ck->slots[tid].next;
+                done = ck->slots[tid].processed;
+                found = ck->slots[tid].primes;
+            }
+            const u64 every = (u64)std::max(1, c.log_every);
+            Sampler ps(c.prime_log, Tag::PRIME, from), cs(c.check_log, Tag::CHECK, from);
+
+            // stream mode hands `mine` to the sinks every `segment` numbers, so it stays small;
+            // checkpointing publishes progress at the same boundaries
+            const u64 seg = (sinks || ck) ? c.segment : hi - lo + 1;
+            const auto t0 = std::chrono::steady_clock::now();
+
+            for (u64 s_lo = from; s_lo <= hi && s_lo >= from; s_lo += seg) {
+                const u64 s_hi = std::min(hi, s_lo + seg - 1);
+                for (u64 n = s_lo; n <= s_hi; ++n) {
+                    // optional CHECKs (B1+immediate, log_every>=0); LP::checks is resolved before the run
+                    if constexpr (LP::checks) {
+                        if (done % every == 0 && cs.take(log, tid, n)) log.check(tid, n, (u64)std::sqrt((long double)n));
+                    }
+                    if (prime_single(n, c, divs)) {
+                        if constexpr (LP::primes) { if (ps.take(log, tid, n)) log.prime(tid, n); }
+                        mine.push_back(n);
+                        ++found;
+                    }
+                    ++done;
+                }
+                if (sinks) { sinks->consume(tid, mine); mine.clear(); }
+                if (ck) ck->publish((size_t)tid, { s_hi + 1, done, found });
+            }
+            st[tid] = { done, found, divs, ns_since(t0) };
+            if constexpr (LP::checks) cs.finish(log, tid, hi + 1);
+            if constexpr (LP::primes) ps.finish(log, tid, hi + 1);
+            {
+                std::ostringstream os;
+                os << "range=[" << lo << "-" << hi << "], processed=" << done << ", primes=" << found;
+                log.finish(tid, os.str());
+            }
+            kept[tid] = mine.size();  // < found after a resume: earlier primes weren't kept
+            if (!mine.empty()) last[tid] = mine.back();
+            counted.wait([&] {
+                for (int t = 0; t < T; ++t) {
+                    offset[t + 1] = offset[t] + kept[t];
+                    r.processed += st[t].processed;
+                    r.prime_count += st[t].primes;
+                }
+                reduce_stats(r, st);
+                if (!sinks && !gaps) r.primes.resize((size_t)offset[T]);
+                });
+            if (gaps) {
+                u64 prev = 0;
+                for (int t = tid - 1; t >= 0 && !prev; --t) prev = last[t];
+                GapStore::Part part = GapStore::encode(mine.data(), mine.size(), offset[tid], prev);
+                std::vector<u64>().swap(mine);
+                byte_off[tid + 1] = part.bytes.size();
+                encoded.wait([&] {
+                    u64 hi_p = 0;
+                    for (int t = 0; t < T; ++t) { byte_off[t + 1] += byte_off[t]; if (last[t]) hi_p = last[t]; }
+                    r.packed.assemble(offset[T], (size_t)byte_off[T], hi_p);
+                    });
+                r.packed.place(part, offset[tid], (size_t)byte_off[tid]);
+            }
+            else if (!sinks) std::copy(mine.begin(), mine.end(), r.primes.begin() + (ptrdiff_t)offset[tid]);
+            });
+    }
+    for (auto& th : ths) th.join();
+    return r;
+}
+
+// A1B1 ordered=1: threads pull chunks of `segment` numbers from a shared counter. A
+// finished chunk parks in a reorder buffer keyed on chunk index; whoever completes the
+// oldest outstanding chunk drains every consecutive ready chunk, so PRIME lines, results
+// and sinks all see increasing order. One thread at a time drains: it moves the ready run
+// out under the lock and writes it after unlocking, so producers never wait on stdout.
+// A thread may not start a chunk more than `window` ahead of the oldest unfinished one,
+// which bounds the buffer.
+template <class LP>
+static Result run_B1_ordered(const Config& c, Logger& log, SinkSet* sinks) {
+    Result r;
+    const int T = std::max(1, c.threads);
+    const u64 N = c.max_value;
+    const u64 base = std::max<u64>(2, c.start_after + 1);
+    const u64 seg = c.segment;
+    const u64 nchunks = (N >= base) ? (N - base) / seg + 1 : 0;
+    const u64 window = std::max<u64>(c.ordered_window, 2 * (u64)T);
+    const bool gaps = !sinks && c.prime_store == "gaps";
+    Stats st(T);
+
+    log.run("Variant=A1B1 ordered  threads=" + std::to_string(T) + "  max=" + std::to_string(N) +
+        "  chunk=" + std::to_string(seg) + "  window=" + std::to_string(window));
+
+    std::vector<std::vector<u64>> slot((size_t)window);
+    std::vector<int> finder((size_t)window, -1);  // -1 = not ready
+    std::vector<Sampler> ps(T, Sampler(c.prime_log, Tag::PRIME, base));
+    std::vector<std::vector<u64>> spare;          // drained buffers, handed back to workers
+    std::mutex m;
+    std::condition_variable cv;
+    u64 next_emit = 0;
+    bool emitting = false;
+    std::atomic<u64> next_chunk{ 0 };
+
+    // caller holds lk; returns with it held. Only one thread drains; the others just park
+    // their chunk and the drainer picks it up on its next round.
+    auto drain = [&](std::unique_lock<std::mutex>& lk) {
+        if (emitting) return;
+        emitting = true;
+        std::vector<std::pair<int, std::vector<u64>>> run;
+        for (;;) {
+            for (size_t i; finder[i = (size_t)(next_emit % window)] >= 0; ++next_emit) {
+                run.emplace_back(finder[i], std::move(slot[i]));
+                finder[i] = -1;
+            }
+            if (run.empty()) break;
+            lk.unlock();
+            cv.notify_all();  // the window moved
+            for (auto& [t, v] : run) {
+                if constexpr (LP::primes) for (u64 p : v) if (ps[t].take(log, t, p)) log.prime(t, p);
+                if (sinks) sinks->consume(0, v);
+                else if (gaps) for (u64 p : v) r.packed.push_back(p);
+                else r.primes.insert(r.primes.end(), v.begin(), v.end());
+                v.clear();
+            }
+            lk.lock();
+            for (auto& e : run) spare.push_back(std::move(e.second));
+            run.clear();
+        }
+        emitting = false;
+        };
+
+    std::vector<std::thread> ths; ths.reserve(T);
+    for (int tid = 0; tid < T; ++tid) {
+        ths.emplace_back([&, tid] {
+            pin_worker(c, tid);
+            log.start(tid, "ordered chunks of " + std::to_string(seg));
+            std::vector<u64> mine;
+            u64 done = 0, found = 0, divs = 0, busy = 0;
+            const u64 every = (u64)std::max(1, c.log_every);
+            Sampler cs(c.check_log, Tag::CHECK, base);
+
+            for (u64 k; (k = next_chunk.fetch_add(1, std::memory_order_relaxed)) < nchunks;) {
+                {
+                    std::unique_lock<std::mutex> lk(m);
+                    cv.wait(lk, [&] { return k < next_emit + window; });
+                }
+                const u64 lo = base + k * seg, hi = std::min(N, lo + seg - 1);
+                const auto t0 = std::chrono::steady_clock::now();
+                for (u64 n = lo; n <= hi; ++n) {
+                    if constexpr (LP::checks) {
+                        if (done % every == 0 && cs.take(log, tid, n)) log.check(tid, n, (u64)std::sqrt((long double)n));
                     }
+                    if (prime_single(n, c, divs)) { mine.push_back(n); ++found; }
+                    ++done;
                 }
-                if (prime_single(n, c)) { log.prime(tid, n); mine.push_back(n); }
-                ++done;
+                busy += ns_since(t0);
+                {
+                    std::unique_lock<std::mutex> lk(m);
+                    const size_t i = (size_t)(k % window);
+                    slot[i] = std::move(mine);
+                    finder[i] = tid;
+                    mine.clear();
+                    if (!spare.empty()) { mine = std::move(spare.back()); spare.pop_back(); }  // reuse a drained buffer
+                    drain(lk);
+                }
+                cv.notify_all();
             }
+            if constexpr (LP::checks) cs.finish(log, tid, N + 1);
+            st[tid] = { done, found, divs, busy };
+            log.finish(tid, "ordered, processed=" + std::to_string(done) + ", primes=" + std::to_string(found));
+            });
+    }
+    for (auto& th : ths) th.join();
+    if constexpr (LP::primes) for (int t = 0; t < T; ++t) ps[t].finish(log, t, N + 1);
+    for (int t = 0; t < T; ++t) { r.processed += st[t].processed; r.prime_count += st[t].primes; }
+    reduce_stats(r, st);
+    return r;
+}
+
+// pipeline=1 (B1): compute workers only test numbers and ship each segment as a Span.
+// Lane t (compute worker t) flows through its own SPSC rings: compute -> analytics
+// thread t % A (count, sum, gaps, checksum) -> output thread t % O (PRIME/CHECK lines,
+// sinks, stored results). Each ring has one producer and one consumer, and a lane's
+// spans stay in order end to end, so per-lane output order matches run_B1. The output
+// stage publishes a span's checkpoint progress once its primes are in the sinks.
+struct Span {
+    std::vector<u64> primes;
+    std::vector<u64> checks;  // numbers that get a CHECK line (before sampling)
+    Progress at;              // lane progress after this span
+};
+
+static u64 mix64(u64 x) {  // splitmix64 finalizer
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+template <class LP>
+static Result run_B1_pipeline(const Config& c, Logger& log, SinkSet* sinks, Checkpoint* ck) {
+    Result r;
+    const int T = std::max(1, c.threads), A = c.analytics_threads, O = c.output_threads;
+    const u64 N = c.max_value;
+    const bool gaps = !sinks && c.prime_store == "gaps";
+    Stats st(T);
+
+    log.run("Variant=A" + std::string(c.printing == "immediate" ? "1" : "2") + "B1 pipeline  compute=" + std::to_string(T) +
+        "  analytics=" + std::to_string(A) + "  output=" + std::to_string(O) + "  max=" + std::to_string(N));
+
+    std::vector<std::unique_ptr<SpscQueue<Span>>> q1, q2;  // compute->analytics, analytics->output
+    for (int t = 0; t < T; ++t) { q1.emplace_back(new SpscQueue<Span>(8)); q2.emplace_back(new SpscQueue<Span>(8)); }
+
+    struct alignas(CACHE_LINE) LaneStats { u64 count = 0, sum = 0, first = 0, last = 0, gap = 0, gap_after = 0, check = 0; };
+    std::vector<LaneStats> ls(T);
+    std::vector<std::vector<u64>> kept(T);
+
+    std::vector<std::thread> ths;
+    for (int tid = 0; tid < T; ++tid) {
+        auto [lo, hi] = thread_range(c, tid);
+        ths.emplace_back([&, tid, lo = lo, hi = hi] {
+            pin_worker(c, tid);
             {
-                std::lock_guard<std::mutex> lk(mx);
-                r.primes.insert(r.primes.end(), mine.begin(), mine.end());
-                r.primes_per_thread[tid] = mine.size();
-                r.proc_per_thread[tid] = done;
-                r.processed += done;
-            }
-            std::ostringstream os;
-            os << "range=[" << lo << "-" << hi << "], processed=" << done << ", primes=" << mine.size();
-            log.finish(tid, os.str());
+                std::ostringstream os; os << "range=[" << lo << "-" << hi << "]";
+                log.start(tid, os.str());
+            }
+            u64 done = 0, found = 0, divs = 0, from = lo;
+            if (ck && ck->resumed && ck->slots[tid].next) {
+                from = ck->slots[tid].next;
+                done = ck->slots[tid].processed;
+                found = ck->slots[tid].primes;
+            }
+            const u64 every = (u64)std::max(1, c.log_every);
+            const auto t0 = std::chrono::steady_clock::now();
+            Backoff bo;
+            for (u64 s_lo = from; s_lo <= hi && s_lo >= from; s_lo += c.segment) {
+                const u64 s_hi = std::min(hi, s_lo + c.segment - 1);
+                Span sp;
+                for (u64 n = s_lo; n <= s_hi; ++n) {
+                    if constexpr (LP::checks) { if (done % every == 0) sp.checks.push_back(n); }
+                    if (prime_single(n, c, divs)) { sp.primes.push_back(n); ++found; }
+                    ++done;
+                }
+                sp.at = { s_hi + 1, done, found };
+                while (!q1[tid]->push(std::move(sp))) bo.pause();
+                bo.reset();
+            }
+            st[tid] = { done, found, divs, ns_since(t0) };
+            q1[tid]->close();  // FIN is logged by the output stage, after the lane's last line
             });
     }
+    for (int a = 0; a < A; ++a) {
+        ths.emplace_back([&, a] {
+            pin_worker(c, T + a);
+            std::vector<int> lanes;
+            for (int t = a; t < T; t += A) lanes.push_back(t);
+            Backoff bo;
+            while (!lanes.empty()) {
+                bool got = false;
+                for (size_t i = 0; i < lanes.size();) {
+                    const int t = lanes[i];
+                    Span sp;
+                    if (q1[t]->pop(sp)) {
+                        LaneStats& L = ls[t];
+                        for (u64 p : sp.primes) {
+                            if (L.count && p - L.last > L.gap) { L.gap = p - L.last; L.gap_after = L.last; }
+                            if (!L.count) L.first = p;
+                            L.last = p;
+                            ++L.count;
+                            L.sum += p;
+                            L.check += mix64(p);
+                        }
+                        while (!q2[t]->push(std::move(sp))) bo.pause();
+                        bo.reset();
+                        got = true;
+                        ++i;
+                    }
+                    else if (q1[t]->done()) { q2[t]->close(); lanes.erase(lanes.begin() + (ptrdiff_t)i); }
+                    else ++i;
+                }
+                if (got) bo.reset(); else if (!lanes.empty()) bo.pause();
+            }
+            });
+    }
+    for (int o = 0; o < O; ++o) {
+        ths.emplace_back([&, o] {
+            pin_worker(c, T + A + o);
+            std::vector<int> lanes;
+            for (int t = o; t < T; t += O) lanes.push_back(t);
+            std::vector<Sampler> ps, cs;
+            for (int t : lanes) {
+                const u64 lo = thread_range(c, t).first;
+                const u64 from = (ck && ck->resumed && ck->slots[t].next) ? ck->slots[t].next : lo;
+                ps.emplace_back(c.prime_log, Tag::PRIME, from);
+                cs.emplace_back(c.check_log, Tag::CHECK, from);
+            }
+            std::vector<bool> open(lanes.size(), true);
+            size_t left = lanes.size();
+            Backoff bo;
+            while (left) {
+                bool got = false;
+                for (size_t i = 0; i < lanes.size(); ++i) {
+                    if (!open[i]) continue;
+                    const int t = lanes[i];
+                    Span sp;
+                    if (q2[t]->pop(sp)) {
+                        // CHECK and PRIME lines merged by n, CHECK first, as run_B1 prints them
+                        size_t j = 0;
+                        for (u64 p : sp.primes) {
+                            if constexpr (LP::checks) {
+                                for (; j < sp.checks.size() && sp.checks[j] <= p; ++j)
+                                    if (cs[i].take(log, t, sp.checks[j])) log.check(t, sp.checks[j], (u64)std::sqrt((long double)sp.checks[j]));
+                            }
+                            if constexpr (LP::primes) { if (ps[i].take(log, t, p)) log.prime(t, p); }
+                        }
+                        if constexpr (LP::checks) {
+                            for (; j < sp.checks.size(); ++j)
+                                if (cs[i].take(log, t, sp.checks[j])) log.check(t, sp.checks[j], (u64)std::sqrt((long double)sp.checks[j]));
+                        }
+                        if (sinks) sinks->consume(t, sp.primes);
+                        else kept[t].insert(kept[t].end(), sp.primes.begin(), sp.primes.end());
+                        if (ck) ck->publish((size_t)t, sp.at);
+                        got = true;
+                    }
+                    else if (q2[t]->done()) {
+                        auto [lo, hi] = thread_range(c, t);
+                        if constexpr (LP::checks) cs[i].finish(log, t, hi + 1);
+                        if constexpr (LP::primes) ps[i].finish(log, t, hi + 1);
+                        std::ostringstream os;
+                        os << "range=[" << lo << "-" << hi << "], processed=" << st[t].processed << ", primes=" << st[t].primes;
+                        log.finish(t, os.str());
+                        open[i] = false;
+                        --left;
+                    }
+                }
+                if (got) bo.reset(); else if (left) bo.pause();
+            }
+            });
+    }
+    for (auto& th : ths) th.join();
+
+    for (int t = 0; t < T; ++t) {
+        r.processed += st[t].processed;
+        r.prime_count += st[t].primes;
+        if (!sinks) {
+            if (gaps) for (u64 p : kept[t]) r.packed.push_back(p);
+            else r.primes.insert(r.primes.end(), kept[t].begin(), kept[t].end());
+            std::vector<u64>().swap(kept[t]);
+        }
+    }
+    reduce_stats(r, st);
+
+    // lanes ascend with t, so the only gaps the lanes didn't see are between neighbours
+    r.analytics = true;
+    u64 prev = 0;
+    for (int t = 0; t < T; ++t) {
+        const LaneStats& L = ls[t];
+        if (!L.count) continue;
+        r.prime_sum += L.sum;
+        r.checksum += L.check;
+        if (prev && L.first - prev > r.max_gap) { r.max_gap = L.first - prev; r.max_gap_after = prev; }
+        if (L.gap > r.max_gap) { r.max_gap = L.gap; r.max_gap_after = L.gap_after; }
+        prev = L.last;
+    }
+    return r;
+}
+
+#if defined(_OPENMP)
+// backend=omp: the loops below run under schedule(runtime), set from omp_schedule/omp_chunk
+static void omp_apply_schedule(const Config& c) {
+#if _OPENMP >= 200805
+    omp_sched_t kind = omp_sched_static;
+    if (c.omp_schedule == "dynamic")     kind = omp_sched_dynamic;
+    else if (c.omp_schedule == "guided") kind = omp_sched_guided;
+    omp_set_schedule(kind, c.omp_chunk);
+#else
+    (void)c;  // OpenMP 2.0: schedule(runtime) follows OMP_SCHEDULE
+#endif
+}
+
+// B1 on OpenMP: one parallel region; each window of numbers is an omp for, and the
+// window's primes are merged, sorted and handed on by a single thread. Stream mode uses
+// windows of segment*T numbers, store mode a single window.
+template <class LP>
+static Result run_B1_omp(const Config& c, Logger& log, SinkSet* sinks) {
+    Result r;
+    const int T = std::max(1, c.threads);
+    const long long lo = (long long)std::max<u64>(2, c.start_after + 1);
+    const long long N = (long long)c.max_value;
+    const long long win = sinks ? (long long)(c.segment * (u64)T) : std::max(1LL, N - lo + 1);
+    const bool gaps = !sinks && c.prime_store == "gaps";
+    Stats st(T);
+    std::vector<std::vector<u64>> mine(T);
+    std::vector<Sampler> ps(T, Sampler(c.prime_log, Tag::PRIME, (u64)lo)), cs(T, Sampler(c.check_log, Tag::CHECK, (u64)lo));
+    omp_apply_schedule(c);
+
+    log.run("Variant=A" + std::string(c.printing == "immediate" ? "1" : "2") + "B1 omp  threads=" + std::to_string(T) +
+        "  max=" + std::to_string(N) + "  schedule=" + c.omp_schedule + "," + std::to_string(c.omp_chunk));
+
+    #pragma omp parallel num_threads(T)
+    {
+        const int tid = omp_get_thread_num();
+        pin_worker(c, tid);
+        log.start(tid, "omp " + c.omp_schedule);
+        const u64 every = (u64)std::max(1, c.log_every);
+        u64 done = 0, found = 0, divs = 0, busy = 0;
+        for (long long w = lo; w <= N; w += win) {
+            const long long w_hi = std::min(N, w + win - 1);
+            const auto t0 = std::chrono::steady_clock::now();
+            // nowait + the barrier below: busy stops when this thread runs out of numbers
+            #pragma omp for schedule(runtime) nowait
+            for (long long i = w; i <= w_hi; ++i) {
+                const u64 n = (u64)i;
+                if constexpr (LP::checks) {
+                    if (done % every == 0 && cs[tid].take(log, tid, n)) log.check(tid, n, (u64)std::sqrt((long double)n));
+                }
+                if (prime_single(n, c, divs)) {
+                    if constexpr (LP::primes) { if (ps[tid].take(log, tid, n)) log.prime(tid, n); }
+                    mine[tid].push_back(n);
+                    ++found;
+                }
+                ++done;
+            }
+            busy += ns_since(t0);
+            #pragma omp barrier
+            #pragma omp single
+            {
+                // each thread's chunks ascend, so a sort of the concatenation restores order
+                std::vector<u64> all;
+                for (auto& v : mine) { all.insert(all.end(), v.begin(), v.end()); v.clear(); }
+                std::sort(all.begin(), all.end());
+                if (sinks) sinks->consume(0, all);
+                else if (gaps) for (u64 p : all) r.packed.push_back(p);
+                else r.primes = std::move(all);
+            }
+        }
+        if constexpr (LP::checks) cs[tid].finish(log, tid, (u64)N + 1);
+        if constexpr (LP::primes) ps[tid].finish(log, tid, (u64)N + 1);
+        st[tid] = { done, found, divs, busy };
+        log.finish(tid, "omp, processed=" + std::to_string(done) + ", primes=" + std::to_string(found));
+    }
+    for (int t = 0; t < T; ++t) { r.processed += st[t].processed; r.prime_count += st[t].primes; }
+    reduce_stats(r, st);
+    return r;
+}
+#endif
+
+// B2: per-number, share divisors among threads; owner chosen round-robin (balanced)
+template <class LP>
+static Result run_B2(const Config& c, Logger& log, SinkSet* sinks, Checkpoint* ck) {
+    Result r;
+    const int T = std::max(1, c.threads);
+    u64 N = c.max_value;
+
+    log.run("Variant=A" + std::string(c.printing == "immediate" ? "1" : "2") + "B2  threads=" + std::to_string(T) + "  max=" + std::to_string(N) +
+        (c.backend == "omp" ? "  omp schedule=" + c.omp_schedule + "," + std::to_string(c.omp_chunk)
+            : c.batch > 1 ? "  batch=" + std::to_string(c.batch) : std::string()));
+
+    for (int tid = 0; tid < T; ++tid) log.start(tid, "owner mode");
+
+    // own: owner counters, main thread only; work: worker divisions and busy time
+    Stats own(T), work(T);
+    int next_owner = 0; // round-robin owner assignment for nicer per-thread balance
+    u64 first = std::max<u64>(2, c.start_after + 1);
+    if (ck && ck->resumed && ck->slots[0].next) {
+        first = ck->slots[0].next;
+        r.processed = ck->slots[0].processed;
+        r.prime_count = ck->slots[0].primes;
+        u64 owned = 0;
+        for (int t = 0; t < T; ++t) {
+            own[t].processed = ck->slots[1 + t].processed;
+            own[t].primes = ck->slots[1 + t].primes;
+            owned += own[t].processed;
+        }
+        next_owner = (int)(owned % (u64)T);
+    }
+    std::vector<Sampler> ps(T, Sampler(c.prime_log, Tag::PRIME, first));
+    std::vector<u64>& out = r.primes;  // stream mode: reused as the chunk buffer
+    const bool gaps = !sinks && c.prime_store == "gaps";
+
+    // checkpoint: everything below n is settled
+    auto save = [&](u64 n) {
+        std::lock_guard<std::mutex> lk(ck->m);
+        ck->slots[0] = { n, r.processed, r.prime_count };
+        for (int t = 0; t < T; ++t) ck->slots[1 + t] = { 0, own[t].processed, own[t].primes };
+        };
+    auto settle = [&](u64 n, int owner, bool is_p) {
+        own[owner].processed++;
+        if (is_p) {
+            if constexpr (LP::primes) { if (ps[owner].take(log, owner, n)) log.prime(owner, n); }
+            if (gaps) r.packed.push_back(n);
+            else      out.push_back(n);
+            own[owner].primes++;
+            ++r.prime_count;
+            if (sinks && out.size() >= c.segment) { sinks->consume(0, out); out.clear(); }
+        }
+        ++r.processed;
+        };
+
+#if defined(_OPENMP)
+    if (c.backend == "omp") {
+        // one parallel region for the run; per number, the divisor blocks are an omp for that
+        // is cancelled once a factor turns up (OMP_CANCELLATION=true; the flag check covers
+        // runtimes without it), and a single thread settles the number
+        omp_apply_schedule(c);
+        std::atomic<bool> found(false);
+        u64 tail = 0, saved = first;
+        #pragma omp parallel num_threads(T)
+        {
+            const int tid = omp_get_thread_num();
+            pin_worker(c, tid);
+            u64 divs = 0, busy = 0, skipped = 0;  // every thread walks the same n, so `skipped` agrees
+            // a cancellable omp for can't be nowait, so busy ends at this thread's last block;
+            // that costs a clock read per block and is only paid when the table shows it
+            const bool timed = c.thread_stats;
+            for (u64 n = first; n <= N; ++n) {
+                if (c.skip_even && n > 2 && (n % 2 == 0)) { ++skipped; continue; }
+                const u64 lim = (u64)std::sqrt((long double)n);
+                const long long blocks = (long long)(((lim >= 3 ? (lim - 1) / 2 : 0) + DIV_BLOCK - 1) / DIV_BLOCK);
+                const auto t0 = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+                auto t1 = t0;
+                #pragma omp for schedule(runtime)
+                for (long long b = 0; b < blocks; ++b) {
+                    if (found.load(std::memory_order_relaxed)) continue;
+                    const u64 d0 = 3 + 2 * DIV_BLOCK * (u64)b, e = std::min(lim + 1, d0 + 2 * DIV_BLOCK);
+                    for (u64 d = d0; d < e; d += 2) {
+                        if (c.use_6k && !is_6kpm1(d)) continue;
+                        ++divs;
+                        if (n % d == 0) { found.store(true, std::memory_order_relaxed); break; }
+                    }
+                    if (timed) t1 = std::chrono::steady_clock::now();
+#if _OPENMP >= 201307
+                    if (found.load(std::memory_order_relaxed)) {
+                        #pragma omp cancel for
+                    }
+                    #pragma omp cancellation point for
+#endif
+                }
+                busy += (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+                #pragma omp single
+                {
+                    r.processed += skipped;
+                    if (ck && n - saved >= c.segment) { save(n); saved = n; }
+                    const int owner = next_owner;
+                    next_owner = (next_owner + 1) % T;
+                    const bool even = !c.skip_even && n > 2 && n % 2 == 0;
+                    settle(n, owner, n >= 2 && !even && !found.load(std::memory_order_relaxed));
+                    found.store(false, std::memory_order_relaxed);
+                }
+                skipped = 0;
+            }
+            work[tid].divisions = divs;
+            work[tid].busy_ns = busy;
+            if (tid == 0) tail = skipped;
+        }
+        r.processed += tail;
+    }
+    else
+#endif
+    if (c.batch <= 1) {
+        for (u64 n = first; n <= N; ++n) {
+            if (ck && n > first && (n - first) % c.segment == 0) save(n);
+            if (c.skip_even && n > 2 && (n % 2 == 0)) { ++r.processed; continue; }
+
+            const int owner = next_owner;
+            next_owner = (next_owner + 1) % T;
+
+            // no CHECK lines in B2 (keeps it fast/clean)
+            settle(n, owner, prime_parallel(n, c, T, work));
+        }
+    }
+    else {
+        // T persistent workers and one barrier per block. The barrier that ends block b
+        // also starts block b+1, which this thread filled meanwhile; block b is settled
+        // (logged, stored, checkpointed) while the workers test b+1. An empty block ends it.
+        const size_t K = (size_t)c.batch;
+        DivisorBlock blk[2] = { DivisorBlock(K), DivisorBlock(K) };
+        Barrier step(T + 1);
+        u64 n = first;
+        auto fill = [&](DivisorBlock& b) {
+            b.n.clear(); b.owner.clear();
+            b.lo = n; b.skipped = 0;
+            for (; n <= N && b.n.size() < K; ++n) {
+                if (c.skip_even && n > 2 && (n % 2 == 0)) { ++b.skipped; continue; }
+                b.composite[b.n.size()].store(false, std::memory_order_relaxed);
+                b.n.push_back(n);
+                b.owner.push_back(next_owner);
+                next_owner = (next_owner + 1) % T;
+            }
+            b.hi = n - 1;
+            };
+
+        std::vector<std::thread> ths; ths.reserve(T);
+        for (int tid = 0; tid < T; ++tid) {
+            ths.emplace_back([&, tid] {
+                pin_worker(c, tid);
+                u64 divs = 0, busy = 0;
+                for (int k = 0;; k ^= 1) {
+                    step.wait();
+                    if (blk[k].n.empty()) break;
+                    const auto t0 = std::chrono::steady_clock::now();
+                    divs += blk[k].test_slice(c, tid, T);
+                    busy += ns_since(t0);
+                }
+                work[tid].divisions = divs;
+                work[tid].busy_ns = busy;
+                });
+        }
+        fill(blk[0]);
+        step.wait();
+        u64 saved = first;
+        int k = 0;
+        for (; !blk[k].n.empty(); k ^= 1) {
+            fill(blk[k ^ 1]);
+            step.wait();
+            DivisorBlock& b = blk[k];
+            r.processed += b.skipped;
+            for (size_t i = 0; i < b.n.size(); ++i)
+                settle(b.n[i], b.owner[i], b.n[i] >= 2 && !b.composite[i].load(std::memory_order_relaxed));
+            if (ck && b.hi + 1 - saved >= c.segment) { save(b.hi + 1); saved = b.hi + 1; }
+        }
+        r.processed += blk[k].skipped;  // the closing block holds no candidates, only trailing evens
+        for (auto& th : ths) th.join();
+    }
+    if (sinks) { sinks->consume(0, out); out.clear(); out.shrink_to_fit(); }
+    if constexpr (LP::primes) for (int tid = 0; tid < T; ++tid) ps[tid].finish(log, tid, N + 1);
+
+    for (int t = 0; t < T; ++t) { work[t].processed = own[t].processed; work[t].primes = own[t].primes; }
+    reduce_stats(r, work);
+
+    for (int tid = 0; tid < T; ++tid) {
+        std::ostringstream os; os << "owner processed=" << own[tid].processed << ", primes=" << own[tid].primes;
+        log.finish(tid, os.str());
+    }
+    return r;
+}
+
+// division=adaptive. Splitting one number's divisors costs a handoff per block of K
+// candidates, so it only pays once a thread's share of the divisions clearly outweighs
+// that. Startup measures both costs; the crossover is the n where each thread's share of
+// a number's ~sqrt(n)/2 divisions is 8x its share of the per-block handoff.
+static u64 adaptive_batch(const Config& c) { return c.batch > 1 ? c.batch : 256; }
+
+static u64 calibrate_crossover(const Config& c) {
+    using clk = std::chrono::steady_clock;
+    const int T = std::max(1, c.threads);
+    if (T == 1) return c.max_value + 1;
+
+    // ns per trial division: prime_single on a prime near 1e12 runs its full loop
+    const u64 p = 1000000000039ULL;
+    volatile int sink = 0;
+    u64 made = 0;
+    auto t0 = clk::now();
+    for (int i = 0; i < 20; ++i) sink = sink + prime_single(p, c, made);
+    const double div_ns = std::chrono::duration<double, std::nano>(clk::now() - t0).count() / (double)std::max<u64>(1, made);
+
+    // ns per handoff: one barrier round between T pooled workers and the feeder
+    const int rounds = 200;
+    Barrier step(T + 1);
+    std::vector<std::thread> ths;
+    for (int t = 0; t < T; ++t) ths.emplace_back([&] { for (int i = 0; i < rounds; ++i) step.wait(); });
+    t0 = clk::now();
+    for (int i = 0; i < rounds; ++i) step.wait();
+    const double round_ns = std::chrono::duration<double, std::nano>(clk::now() - t0).count() / rounds;
     for (auto& th : ths) th.join();
-    return r;
+
+    const double per_number = round_ns / (double)adaptive_batch(c);
+    const double divs = 8.0 * per_number * T / std::max(div_ns, 0.01);  // odd divisors per number at break-even
+    const double n = (2.0 * divs) * (2.0 * divs);
+    return (n >= (double)c.max_value) ? c.max_value + 1 : std::max<u64>(2, (u64)n);
 }
 
-// B2: per-number, share divisors among threads; owner chosen round-robin (balanced)
-static Result run_B2(const Config& c, Logger& log) {
-    Result r;
+template <class LP>
+static Result run_adaptive(const Config& c, Logger& log, SinkSet* sinks) {
     const int T = std::max(1, c.threads);
-    u64 N = c.max_value;
+    const u64 x = c.crossover ? c.crossover : calibrate_crossover(c);
+    log.run("Adaptive: crossover=" + std::to_string(x) + (c.crossover ? " (configured)" : " (calibrated)") +
+        ", range below, divisor split from there");
 
-    log.run("Variant=A" + std::string(c.printing == "immediate" ? "1" : "2") + "B2  threads=" + std::to_string(T) + "  max=" + std::to_string(N));
+    Config lo = c, hi = c;
+    lo.division = "range";
+    lo.max_value = std::min(c.max_value, x - 1);
+    hi.division = "per_number";
+    hi.start_after = std::max(c.start_after, x - 1);
+    hi.batch = adaptive_batch(c);
 
-    for (int tid = 0; tid < T; ++tid) log.start(tid, "owner mode");
+    Result r;
+    if (lo.max_value > c.start_after && lo.max_value >= 2) {
+#if defined(_OPENMP)
+        if (c.backend == "omp") r = run_B1_omp<LP>(lo, log, sinks);
+        else
+#endif
+        r = run_B1<LP>(lo, log, sinks, nullptr);
+    }
+    r.primes_per_thread.resize(T, 0);
+    r.proc_per_thread.resize(T, 0);
+    r.divisions_per_thread.resize(T, 0);
+    r.busy_ns_per_thread.resize(T, 0);
+    r.split_per_thread.assign(T, 0);
+    r.crossover = x;
+    if (hi.start_after < c.max_value) {
+        if (sinks) sinks->lane_base = T;
+        Result s = run_B2<LP>(hi, log, sinks, nullptr);
+        if (sinks) sinks->lane_base = 0;
+        r.primes.insert(r.primes.end(), s.primes.begin(), s.primes.end());
+        for (u64 q : s.packed) r.packed.push_back(q);
+        r.processed += s.processed;
+        r.prime_count += s.prime_count;
+        for (int t = 0; t < T; ++t) {
+            r.proc_per_thread[t] += s.proc_per_thread[t];
+            r.primes_per_thread[t] += s.primes_per_thread[t];
+            r.divisions_per_thread[t] += s.divisions_per_thread[t];
+            r.busy_ns_per_thread[t] += s.busy_ns_per_thread[t];
+            r.split_per_thread[t] = s.proc_per_thread[t];
+        }
+    }
+    return r;
+}
 
-    std::vector<u64> proc_by(T, 0), primes_by(T, 0);
-    int next_owner = 0; // round-robin owner assignment for nicer per-thread balance
+// Picks the HotLog instantiation matching the runtime tag mask
+template <class Run>
+static Result with_hot_log(const Config& c, const Logger& log, Run&& run) {
+    const bool primes = log.on(Tag::PRIME);
+    const bool checks = log.on(Tag::CHECK) && c.printing == "immediate" && c.log_every >= 0;
+    if (primes && checks) return run(HotLog<true, true>{});
+    if (primes)           return run(HotLog<true, false>{});
+    if (checks)           return run(HotLog<false, true>{});
+    return run(HotLog<false, false>{});
+}
+
+#if !defined(_WIN32)
+/* ---------- worker processes ---------- */
+// procs=K: main forks K workers before any thread starts. Worker k runs the usual engine on
+// proc_config(c, k) and reports through one shared mapping: a completion ring (any worker
+// pushes, the coordinator pops; each slot carries a sequence number, so neither side
+// locks) followed by a stats block per worker thread. A worker's primes go to their own
+// shm object, created once their count is known; deferred events go as spill run files.
+struct ProcDone {
+    u64 k = 0, processed = 0, prime_count = 0, prime_sum = 0, checksum = 0;
+    u64 max_gap = 0, max_gap_after = 0, first = 0, last = 0;
+    u64 kept = 0, runs = 0, analytics = 0, crossover = 0;
+};
+struct ProcThread { u64 processed, primes, divisions, busy_ns, split; };
 
-    for (u64 n = 2; n <= N; ++n) {
-        if (c.skip_even && n > 2 && (n % 2 == 0)) { ++r.processed; continue; }
+class ProcRegion {
+public:
+    ~ProcRegion() { if (base) munmap(base, bytes); }
 
-        const int owner = next_owner;
-        next_owner = (next_owner + 1) % T;
+    bool create(int procs, int threads) {
+        K = procs; T = threads;
+        cap = 2;
+        while (cap < (u64)K) cap <<= 1;
+        bytes = sizeof(Head) + cap * sizeof(Slot) + (size_t)K * T * sizeof(ProcThread);
+        const std::string name = "/prime_threads." + std::to_string(process_id());
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) return false;
+        shm_unlink(name.c_str());  // the mapping outlives the name; forked workers inherit it
+        void* p = (ftruncate(fd, (off_t)bytes) == 0) ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        base = (char*)p;
+        new (head()) Head();
+        for (u64 i = 0; i < cap; ++i) new (&slot(i)) Slot{ { i }, {} };
+        return true;
+    }
 
-        proc_by[owner]++;
+    ProcThread& thread(int k, int t) { return ((ProcThread*)(base + sizeof(Head) + cap * sizeof(Slot)))[(size_t)k * T + t]; }
 
-        // no CHECK lines in B2 (keeps it fast/clean)
-        bool is_p = prime_parallel(n, c, T);
-        if (is_p) { log.prime(owner, n); r.primes.push_back(n); primes_by[owner]++; }
-        ++r.processed;
+    // worker side (several processes)
+    void push(const ProcDone& d) {
+        const u64 pos = head()->tail.fetch_add(1);
+        Slot& s = slot(pos);
+        while (s.seq.load(std::memory_order_acquire) != pos) std::this_thread::yield();
+        s.d = d;
+        s.seq.store(pos + 1, std::memory_order_release);
+    }
+    // coordinator side (one thread)
+    bool pop(ProcDone& d) {
+        Slot& s = slot(next);
+        if (s.seq.load(std::memory_order_acquire) != next + 1) return false;
+        d = s.d;
+        s.seq.store(next + cap, std::memory_order_release);
+        ++next;
+        return true;
     }
 
-    r.proc_per_thread = proc_by;
-    r.primes_per_thread = primes_by;
+private:
+    struct Head { std::atomic<u64> tail{ 0 }; };
+    struct Slot { std::atomic<u64> seq; ProcDone d; };
+    static_assert(std::atomic<u64>::is_always_lock_free, "shared-memory ring needs address-free atomics");
 
-    for (int tid = 0; tid < T; ++tid) {
-        std::ostringstream os; os << "owner processed=" << proc_by[tid] << ", primes=" << primes_by[tid];
-        log.finish(tid, os.str());
+    Head* head() { return (Head*)base; }
+    Slot& slot(u64 i) { return ((Slot*)(base + sizeof(Head)))[i & (cap - 1)]; }
+
+    char* base = nullptr;
+    size_t bytes = 0;
+    int K = 0, T = 0;
+    u64 cap = 0, next = 0;
+};
+
+static std::string proc_shm_name(u64 coord, u64 k) { return "/prime_threads." + std::to_string(coord) + "." + std::to_string(k); }
+static std::string proc_run_path(u64 coord, u64 k, size_t i) {
+    return (std::filesystem::temp_directory_path() /
+        ("prime_threads_" + std::to_string(coord) + "_w" + std::to_string(k) + "_" + std::to_string(i) + ".run")).string();
+}
+
+// worker k: publish r (primes, deferred runs, per-thread stats) and push the completion record
+static bool proc_report(ProcRegion& reg, u64 coord, int k, const Config& c, Logger& log, const Result& r) {
+    ProcDone d;
+    d.k = (u64)k;
+    d.processed = r.processed;
+    d.prime_count = r.prime_count;
+    d.prime_sum = r.prime_sum;
+    d.checksum = r.checksum;
+    d.max_gap = r.max_gap;
+    d.max_gap_after = r.max_gap_after;
+    d.analytics = r.analytics;
+    d.crossover = r.crossover;
+    d.kept = (c.prime_store == "gaps") ? r.packed.size() : (u64)r.primes.size();
+    if (d.kept) {
+        d.first = (c.prime_store == "gaps") ? r.packed[0] : r.primes.front();
+        d.last = (c.prime_store == "gaps") ? r.packed.last : r.primes.back();
+        const std::string name = proc_shm_name(coord, (u64)k);
+        const size_t len = (size_t)d.kept * sizeof(u64);
+        const int fd = shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+        if (fd < 0) return false;
+        void* p = (ftruncate(fd, (off_t)len) == 0) ? mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (p == MAP_FAILED) { shm_unlink(name.c_str()); return false; }
+        u64* out = (u64*)p;
+        if (c.prime_store == "gaps") for (u64 q : r.packed) *out++ = q;
+        else std::memcpy(out, r.primes.data(), len);
+        munmap(p, len);
+    }
+    std::vector<std::string> runs = log.hand_off();
+    for (size_t i = 0; i < runs.size(); ++i) {
+        std::error_code ec;
+        std::filesystem::rename(runs[i], proc_run_path(coord, (u64)k, i), ec);
+        if (ec) return false;
+    }
+    d.runs = runs.size();
+    const int T = std::max(1, c.threads);
+    for (int t = 0; t < T; ++t) {
+        auto at = [&](const std::vector<u64>& v) { return (size_t)t < v.size() ? v[(size_t)t] : 0; };
+        reg.thread(k, t) = { at(r.proc_per_thread), at(r.primes_per_thread), at(r.divisions_per_thread),
+            at(r.busy_ns_per_thread), at(r.split_per_thread) };
+    }
+    reg.push(d);
+    return true;
+}
+
+// coordinator: merge worker results in slice order as they complete; a worker that exits
+// without reporting is counted as failed (its slice is missing from the result)
+static Result proc_collect(const Config& c, Logger& log, SinkSet* sinks, ProcRegion& reg,
+    const std::vector<pid_t>& pids, int& failed) {
+    Result r;
+    const int K = c.procs, T = std::max(1, c.threads);
+    const u64 coord = process_id();
+    const bool gaps = !sinks && c.prime_store == "gaps";
+    std::vector<ProcDone> got((size_t)K);
+    std::vector<char> have((size_t)K, 0), exited((size_t)K, 0);
+    int running = (int)pids.size(), next = 0;
+    u64 prev = 0;
+    r.analytics = true;
+    failed = 0;
+
+    auto merge = [&](int k) {
+        const ProcDone& d = got[(size_t)k];
+        r.processed += d.processed;
+        r.prime_count += d.prime_count;
+        r.prime_sum += d.prime_sum;
+        r.checksum += d.checksum;
+        r.analytics = r.analytics && d.analytics;
+        if (!r.crossover) r.crossover = d.crossover;
+        if (d.kept) {
+            if (prev && d.first - prev > r.max_gap) { r.max_gap = d.first - prev; r.max_gap_after = prev; }
+            prev = d.last;
+        }
+        if (d.max_gap > r.max_gap) { r.max_gap = d.max_gap; r.max_gap_after = d.max_gap_after; }
+        for (int t = 0; t < T; ++t) {
+            const ProcThread& pt = reg.thread(k, t);
+            r.proc_per_thread.push_back(pt.processed);
+            r.primes_per_thread.push_back(pt.primes);
+            r.divisions_per_thread.push_back(pt.divisions);
+            r.busy_ns_per_thread.push_back(pt.busy_ns);
+            r.split_per_thread.push_back(pt.split);
+        }
+        if (d.kept) {
+            const std::string name = proc_shm_name(coord, (u64)k);
+            const size_t len = (size_t)d.kept * sizeof(u64);
+            const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            void* p = (fd >= 0) ? mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            if (fd >= 0) close(fd);
+            shm_unlink(name.c_str());
+            if (p == MAP_FAILED) {
+                std::cerr << "WARN: can't map the primes of worker process " << k << "\n";
+                ++failed;
+            }
+            else {
+                const u64* q = (const u64*)p;
+                if (sinks) for (auto* s : sinks->v) s->consume(0, q, (size_t)d.kept);
+                else if (gaps) for (u64 i = 0; i < d.kept; ++i) r.packed.push_back(q[i]);
+                else r.primes.insert(r.primes.end(), q, q + d.kept);
+                munmap(p, len);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lk(log.run_m);
+            for (u64 i = 0; i < d.runs; ++i) log.runs.push_back(proc_run_path(coord, (u64)k, (size_t)i));
+        }
+    };
+    auto lost = [&](int k) {
+        const Config s = proc_config(c, k);
+        std::cerr << "WARN: worker process " << k << " (" << s.start_after + 1 << "-" << s.max_value
+            << ") exited without reporting; its numbers are missing from the results.\n";
+        ++failed;
+        for (int t = 0; t < T; ++t) {
+            r.proc_per_thread.push_back(0); r.primes_per_thread.push_back(0);
+            r.divisions_per_thread.push_back(0); r.busy_ns_per_thread.push_back(0); r.split_per_thread.push_back(0);
+        }
+    };
+
+    Backoff bo;
+    while (next < K) {
+        ProcDone d;
+        bool progress = false;
+        while (reg.pop(d)) {
+            if (d.k < (u64)K) { got[(size_t)d.k] = d; have[(size_t)d.k] = 1; }
+            progress = true;
+        }
+        while (next < K && have[(size_t)next]) merge(next++);
+        int status = 0;
+        pid_t pid;
+        while (running && (pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            const auto it = std::find(pids.begin(), pids.end(), pid);
+            if (it == pids.end()) continue;
+            const int k = (int)(it - pids.begin());
+            exited[(size_t)k] = (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 1 : 2;
+            --running;
+            progress = true;
+        }
+        // a failed worker never pushes; once every worker is gone and the ring is empty, no one will
+        while (next < K && !have[(size_t)next] && (exited[(size_t)next] == 2 || (!running && !progress))) lost(next++);
+        if (progress) bo.reset(); else bo.pause();
     }
+    while (running && waitpid(-1, nullptr, 0) > 0) --running;
+    for (int k = 0; k < K; ++k) shm_unlink(proc_shm_name(coord, (u64)k).c_str());
+    if (!r.analytics) { r.max_gap = r.max_gap_after = r.checksum = 0; }
     return r;
 }
+#endif
+
+// one run of the configured engine over (start_after, max_value]
+static Result run_engine(const Config& cfg, Logger& log, SinkSet* sp, Checkpoint* ck) {
+    if (ordered_mode(cfg))       return with_hot_log(cfg, log, [&](auto lp) { return run_B1_ordered<decltype(lp)>(cfg, log, sp); });
+    if (cfg.division == "adaptive") return with_hot_log(cfg, log, [&](auto lp) { return run_adaptive<decltype(lp)>(cfg, log, sp); });
+    if (cfg.pipeline && cfg.division == "range" && cfg.backend != "omp")
+        return with_hot_log(cfg, log, [&](auto lp) { return run_B1_pipeline<decltype(lp)>(cfg, log, sp, ck); });
+#if defined(_OPENMP)
+    if (cfg.backend == "omp" && cfg.division == "range") return with_hot_log(cfg, log, [&](auto lp) { return run_B1_omp<decltype(lp)>(cfg, log, sp); });
+#endif
+    if (cfg.division == "range") return with_hot_log(cfg, log, [&](auto lp) { return run_B1<decltype(lp)>(cfg, log, sp, ck); });
+    return with_hot_log(cfg, log, [&](auto lp) { return run_B2<decltype(lp)>(cfg, log, sp, ck); });
+}
 
 /* ---------- variant picker ---------- */
 struct Variant { const char* key; const char* div; const char* print; const char* label; };
@@ -366,77 +3091,1024 @@ static int ask_variant() {
     }
 }
 
+#if !defined(_WIN32)
+/* ---------- distributed runs ---------- */
+// `serve <addr>` leases chunks of (start_after, max_value] to `work <addr>` instances and
+// merges their results into the usual Result; addr is unix:/path or [host]:port (TCP).
+// One line per message, worker first:
+//   HELLO <name> <threads>     -> JOB <skip_even> <use_6k>
+//   LEASE                      -> CHUNK <id> <lo> <hi> | WAIT <ms> | DONE
+//   RESULT <id> <processed> <primes> <divisions> <busy_ns> <kept>, then `kept` primes as
+//   raw u64 (host byte order)  -> OK | STALE (the chunk was returned or leased again elsewhere)
+// A chunk not returned within lease_ms, or whose worker disconnects, is leased again; only
+// the current lease holder's result counts. A RESULT that can't describe its chunk (counts
+// past its size, primes outside it or out of order) drops the connection.
+struct Conn {
+    int fd = -1;
+    std::string in;
+
+    explicit Conn(int f) : fd(f) {}
+    ~Conn() { if (fd >= 0) ::close(fd); }
+
+    bool line(std::string& out) {
+        for (;;) {
+            const size_t nl = in.find('\n');
+            if (nl != std::string::npos) { out.assign(in, 0, nl); in.erase(0, nl + 1); return true; }
+            char tmp[4096];
+            const ssize_t n = ::recv(fd, tmp, sizeof tmp, 0);
+            if (n <= 0) return false;
+            in.append(tmp, (size_t)n);
+        }
+    }
+    bool bytes(void* dst, size_t n) {
+        char* d = (char*)dst;
+        const size_t have = std::min(n, in.size());
+        std::memcpy(d, in.data(), have);
+        in.erase(0, have);
+        for (size_t got = have; got < n;) {
+            const ssize_t r = ::recv(fd, d + got, n - got, 0);
+            if (r <= 0) return false;
+            got += (size_t)r;
+        }
+        return true;
+    }
+    bool send(const void* p, size_t n) {
+        const char* s = (const char*)p;
+        while (n) {
+            const ssize_t w = ::send(fd, s, n, 0);
+            if (w <= 0) return false;
+            s += w; n -= (size_t)w;
+        }
+        return true;
+    }
+    bool send(const std::string& s) { return send(s.data(), s.size()); }
+};
+
+// listening (serve) or connected (work) socket for addr; -1 with `err` set on failure
+static int net_socket(const std::string& addr, bool listening, std::string& err) {
+    if (addr.rfind("unix:", 0) == 0) {
+        sockaddr_un sa{};
+        sa.sun_family = AF_UNIX;
+        const std::string path = addr.substr(5);
+        if (path.empty() || path.size() >= sizeof sa.sun_path) { err = "bad socket path"; return -1; }
+        std::memcpy(sa.sun_path, path.c_str(), path.size() + 1);
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) { err = std::strerror(errno); return -1; }
+        if (listening) ::unlink(path.c_str());
+        const bool ok = listening ? (::bind(fd, (sockaddr*)&sa, sizeof sa) == 0 && ::listen(fd, 64) == 0)
+            : ::connect(fd, (sockaddr*)&sa, sizeof sa) == 0;
+        if (!ok) { err = std::strerror(errno); ::close(fd); return -1; }
+        return fd;
+    }
+    const size_t colon = addr.rfind(':');
+    if (colon == std::string::npos) { err = "expected unix:/path or host:port"; return -1; }
+    const std::string host = colon ? addr.substr(0, colon) : "127.0.0.1", port = addr.substr(colon + 1);
+    addrinfo hints{}, * res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (listening) hints.ai_flags = AI_PASSIVE;
+    if (const int rc = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &res)) { err = ::gai_strerror(rc); return -1; }
+    int fd = -1;
+    for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        const int one = 1;
+        bool ok;
+        if (listening) {
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+            ok = ::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, 64) == 0;
+        }
+        else {
+            ok = ::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+            if (ok) ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        }
+        if (!ok) { err = std::strerror(errno); ::close(fd); fd = -1; }
+    }
+    ::freeaddrinfo(res);
+    return fd;
+}
+
+// coordinator side of `serve`: returns when every chunk is in; failed = 1 if it couldn't
+// listen or some chunk never came back (r is then incomplete)
+static Result serve_run(const Config& c, Logger& log, SinkSet* sinks, const std::string& addr, int& failed) {
+    Result r;
+    struct Chunk { u64 lo, hi; int state = 0, owner = -1; std::chrono::steady_clock::time_point due; };  // 0 free, 1 leased, 2 done
+    struct Row { std::string name; u64 chunks = 0, processed = 0, primes = 0, divisions = 0, busy_ns = 0; };
+    std::vector<Chunk> chunks;
+    for (u64 lo = std::max<u64>(2, std::min(c.start_after, c.max_value) + 1); lo <= c.max_value && lo >= 2;) {
+        const u64 hi = (c.max_value - lo < c.lease_chunk) ? c.max_value : lo + c.lease_chunk - 1;
+        chunks.push_back({ lo, hi, 0, -1, {} });
+        lo = hi + 1;
+        if (hi == c.max_value) break;
+    }
+    r.leases = chunks.size();
+
+    std::string err;
+    const int lfd = net_socket(addr, true, err);
+    if (lfd < 0) {
+        std::cerr << "WARN: can't listen on " << addr << ": " << err << "\n";
+        failed = 1;
+        return r;
+    }
+    log.run("Serving " + addr + ": " + std::to_string(chunks.size()) + " chunks of " + std::to_string(c.lease_chunk)
+        + ", lease " + std::to_string(c.lease_ms) + " ms");
+
+    const bool gaps = !sinks && c.prime_store == "gaps";
+    std::mutex m;
+    std::vector<Row> rows;
+    std::map<u64, std::vector<u64>> parked;  // results waiting for an earlier chunk
+    u64 merged = 0, done = 0;
+    int live = 0;  // connections still open
+    std::vector<int> fds;
+    std::vector<std::thread> ths;
+
+    auto lease = [&](int me) -> std::string {
+        const auto now = std::chrono::steady_clock::now();
+        if (done == chunks.size()) return "DONE\n";
+        auto due = std::chrono::steady_clock::time_point::max();
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            Chunk& k = chunks[i];
+            if (k.state == 1 && k.due > now) { due = std::min(due, k.due); continue; }
+            if (k.state == 2) continue;
+            if (k.state == 1) {
+                ++r.leases_again;
+                log.run("Lease " + std::to_string(i) + " expired on " + rows[(size_t)k.owner].name + ", leased to " + rows[(size_t)me].name);
+            }
+            k.state = 1;
+            k.owner = me;
+            k.due = now + std::chrono::milliseconds(c.lease_ms);
+            return "CHUNK " + std::to_string(i) + " " + std::to_string(k.lo) + " " + std::to_string(k.hi) + "\n";
+        }
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count();
+        return "WAIT " + std::to_string(std::max<long long>(10, std::min<long long>(1000, ms))) + "\n";
+    };
+
+    auto serve_one = [&](int fd) {
+        Conn cn(fd);
+        std::string ln, name;
+        int me = -1;
+        if (cn.line(ln) && ln.rfind("HELLO ", 0) == 0) {
+            std::istringstream is(ln.substr(6));
+            is >> name;
+            std::lock_guard<std::mutex> lk(m);
+            me = (int)rows.size();
+            rows.push_back({ name.empty() ? "?" : name });
+            log.run("Worker " + std::to_string(me) + " joined: " + ln.substr(6));
+        }
+        auto bad_result = [&] {
+            std::cerr << "WARN: worker " << me << " (" << name << ") sent a bad result, dropping it: " << ln.substr(0, 80) << "\n";
+            };
+        const bool ok = me >= 0 && cn.send("JOB " + std::to_string(c.skip_even) + " " + std::to_string(c.use_6k) + "\n");
+        while (ok && cn.line(ln)) {
+            std::string reply;
+            if (ln == "LEASE") {
+                std::lock_guard<std::mutex> lk(m);
+                reply = lease(me);
+            }
+            else if (ln.rfind("RESULT ", 0) == 0) {
+                std::istringstream is(ln.substr(7));
+                u64 id = 0, proc = 0, found = 0, divs = 0, busy = 0, kept = 0;
+                if (!(is >> id >> proc >> found >> divs >> busy >> kept) || id >= chunks.size()) { bad_result(); break; }
+                // lo/hi never change, so the chunk's bounds can be checked before taking m
+                const u64 lo = chunks[(size_t)id].lo, hi = chunks[(size_t)id].hi, size = hi - lo + 1;
+                if (proc > size || kept > size || found != kept) { bad_result(); break; }
+                std::vector<u64> primes((size_t)kept);
+                if (kept && !cn.bytes(primes.data(), (size_t)kept * sizeof(u64))) break;
+                bool in_chunk = true;
+                for (size_t i = 0; i < primes.size() && in_chunk; ++i)
+                    in_chunk = primes[i] >= lo && primes[i] <= hi && (i == 0 || primes[i] > primes[i - 1]);
+                if (!in_chunk) { bad_result(); break; }
+                std::lock_guard<std::mutex> lk(m);
+                Chunk& k = chunks[(size_t)id];
+                if (k.state == 0) { bad_result(); break; }  // never leased, or back in the pool
+                if (k.state == 2 || k.owner != me) reply = "STALE\n";
+                else {
+                    k.state = 2;
+                    ++done;
+                    Row& w = rows[(size_t)me];
+                    ++w.chunks; w.processed += proc; w.primes += found; w.divisions += divs; w.busy_ns += busy;
+                    r.processed += proc;
+                    r.prime_count += found;
+                    parked[id] = std::move(primes);
+                    for (auto it = parked.find(merged); it != parked.end(); it = parked.find(++merged)) {
+                        if (sinks) sinks->consume(0, it->second);
+                        else if (gaps) for (u64 q : it->second) r.packed.push_back(q);
+                        else r.primes.insert(r.primes.end(), it->second.begin(), it->second.end());
+                        parked.erase(it);
+                    }
+                    reply = "OK\n";
+                }
+            }
+            else break;
+            if (!cn.send(reply)) break;
+        }
+        std::lock_guard<std::mutex> lk(m);
+        --live;
+        for (size_t i = 0; i < chunks.size(); ++i)
+            if (chunks[i].state == 1 && chunks[i].owner == me) {
+                chunks[i].state = 0;
+                log.run("Worker " + std::to_string(me) + " left, chunk " + std::to_string(i) + " goes back to the pool");
+            }
+        };
+
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            if (done == chunks.size()) break;
+        }
+        pollfd p{ lfd, POLLIN, 0 };
+        if (::poll(&p, 1, 200) <= 0) continue;
+        const int fd = ::accept(lfd, nullptr, nullptr);
+        if (fd < 0) continue;
+        std::lock_guard<std::mutex> lk(m);
+        fds.push_back(fd);
+        ++live;
+        ths.emplace_back(serve_one, fd);
+    }
+    ::close(lfd);
+    if (addr.rfind("unix:", 0) == 0) ::unlink(addr.substr(5).c_str());
+    // idle workers ask for a lease soon and are told DONE; give them a moment to hang up
+    for (int i = 0; i < 40; ++i) {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            if (!live) break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    {
+        // workers still busy on a duplicate lease see the connection close and stop
+        std::lock_guard<std::mutex> lk(m);
+        for (int fd : fds) ::shutdown(fd, SHUT_RDWR);
+    }
+    for (auto& th : ths) th.join();
+    if (done != chunks.size() || merged != chunks.size()) failed = 1;
+
+    for (const Row& w : rows) {
+        r.row_labels.push_back(w.name + " x" + std::to_string(w.chunks));
+        r.proc_per_thread.push_back(w.processed);
+        r.primes_per_thread.push_back(w.primes);
+        r.divisions_per_thread.push_back(w.divisions);
+        r.busy_ns_per_thread.push_back(w.busy_ns);
+    }
+    return r;
+}
+
+// prime_threads work <addr> [variant]: lease chunks from a `serve` coordinator until it has
+// none left, running the configured engine (config.ini) on each
+static int work_main(const std::string& addr, const std::string& variant) {
+    ::signal(SIGPIPE, SIG_IGN);
+    Config cfg = load_cfg("config.ini");
+    const int vidx = find_var(variant.empty() ? "a1b1" : variant);
+    if (vidx < 0) { std::cerr << "Unknown variant " << variant << "\n"; return 1; }
+    if (cfg.division != "adaptive") cfg.division = VARS[vidx].div;
+    cfg.printing = VARS[vidx].print;
+    cfg.result = "store";
+    cfg.prime_store = "vector";
+    std::string why;
+    if (cfg.threads_auto) cfg.threads = detect_threads(cfg.smt, why);
+    cfg.pin_cpus = resolve_affinity(cfg.affinity);
+
+    PrintMode pm = (cfg.printing == "deferred") ? PrintMode::DEFERRED : PrintMode::IMMEDIATE;
+    Logger log(pm);
+    log.set_width(std::max(1, cfg.threads));
+    log.mask = resolve_tag_mask(cfg.log_level, cfg.log_tags);
+
+    // the coordinator may still be starting: retry for a few seconds
+    std::string err;
+    int fd = -1;
+    for (int i = 0; i < 50 && fd < 0; ++i) {
+        fd = net_socket(addr, false, err);
+        if (fd < 0) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (fd < 0) { std::cerr << "WARN: can't connect to " << addr << ": " << err << "\n"; return 1; }
+    Conn cn(fd);
+
+    char host[256] = {};
+    if (::gethostname(host, sizeof host - 1) != 0) std::strcpy(host, "host");
+    std::string ln;
+    if (!cn.send("HELLO " + std::string(host) + ":" + std::to_string(process_id()) + " " + std::to_string(cfg.threads) + "\n")
+        || !cn.line(ln) || ln.rfind("JOB ", 0) != 0) {
+        std::cerr << "WARN: " << addr << " did not answer as a coordinator\n";
+        return 1;
+    }
+    {
+        std::istringstream is(ln.substr(4));
+        int se = 1, s6 = 0;
+        is >> se >> s6;
+        cfg.skip_even = se != 0;
+        cfg.use_6k = s6 != 0;
+    }
+    log.run("Working for " + addr);
+
+    u64 chunks = 0, processed = 0, found = 0;
+    bool finished = false;
+    while (cn.send("LEASE\n") && cn.line(ln)) {
+        if (ln == "DONE") { finished = true; break; }
+        if (ln.rfind("WAIT ", 0) == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::stoll(ln.substr(5))));
+            continue;
+        }
+        std::istringstream is(ln.substr(ln.rfind("CHUNK ", 0) == 0 ? 6 : ln.size()));
+        u64 id = 0, lo = 0, hi = 0;
+        if (!(is >> id >> lo >> hi)) break;
+        Config w = cfg;
+        w.start_after = lo - 1;
+        w.max_value = hi;
+        Result r = run_engine(w, log, nullptr, nullptr);
+        u64 divs = 0, busy = 0;
+        for (u64 d : r.divisions_per_thread) divs += d;
+        for (u64 b : r.busy_ns_per_thread) busy += b;
+        std::ostringstream os;
+        os << "RESULT " << id << " " << r.processed << " " << r.prime_count << " " << divs << " " << busy << " " << r.primes.size() << "\n";
+        if (!cn.send(os.str()) || !cn.send(r.primes.data(), r.primes.size() * sizeof(u64)) || !cn.line(ln)) break;
+        if (ln == "OK") { ++chunks; processed += r.processed; found += r.prime_count; }
+    }
+    log.run("Worker " + std::string(finished ? "done" : "disconnected") + ": " + std::to_string(chunks) + " chunks, "
+        + std::to_string(processed) + " numbers, " + std::to_string(found) + " primes");
+    if (pm == PrintMode::DEFERRED) log.flush_deferred();
+    return 0;
+}
+#endif
+
+/* ---------- output file ---------- */
+// Writable file mapping of a fixed size.
+struct MappedFile {
+    char* p = nullptr;
+    size_t n = 0;
+#if defined(_WIN32)
+    HANDLE f = INVALID_HANDLE_VALUE, m = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    bool create(const std::string& path, size_t size) {
+        n = size;
+#if defined(_WIN32)
+        f = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (f == INVALID_HANDLE_VALUE) return false;
+        if (!size) return true;
+        LARGE_INTEGER sz; sz.QuadPart = (LONGLONG)size;
+        m = CreateFileMappingA(f, nullptr, PAGE_READWRITE, (DWORD)(sz.QuadPart >> 32), (DWORD)sz.QuadPart, nullptr);
+        if (!m) return false;
+        p = (char*)MapViewOfFile(m, FILE_MAP_WRITE, 0, 0, size);
+        return p != nullptr;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (!size) return true;
+        if (::ftruncate(fd, (off_t)size) != 0) return false;
+        void* a = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (a == MAP_FAILED) return false;
+        p = (char*)a;
+        return true;
+#endif
+    }
+
+    bool open_read(const std::string& path) {
+#if defined(_WIN32)
+        f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (f == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(f, &sz) || sz.QuadPart == 0) return false;
+        n = (size_t)sz.QuadPart;
+        m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m) return false;
+        p = (char*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+        return p != nullptr;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) return false;
+        n = (size_t)st.st_size;
+        void* a = ::mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (a == MAP_FAILED) return false;
+        p = (char*)a;
+        return true;
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (p) UnmapViewOfFile(p);
+        if (m) CloseHandle(m);
+        if (f != INVALID_HANDLE_VALUE) CloseHandle(f);
+#else
+        if (p) ::munmap(p, n);
+        if (fd >= 0) ::close(fd);
+#endif
+    }
+};
+
+static inline int digits10(u64 v) { int d = 1; while (v >= 10) { v /= 10; ++d; } return d; }
+static inline int varint_len(u64 v) { int d = 1; while (v >= 0x80) { v >>= 7; ++d; } return d; }
+
+static auto cursor_at(const std::vector<u64>& v, u64 i) { return v.begin() + (ptrdiff_t)i; }
+static auto cursor_at(const GapStore& g, u64 i) { return g.from(i); }
+
+// output_file: each thread sizes its contiguous block of primes, a barrier turns the sizes
+// into file offsets and maps the file, then every thread formats straight into its slice.
+template <class Primes>
+static u64 write_output(const Config& c, const Primes& primes) {
+    const int fmt = c.output_format == "u64" ? 1 : c.output_format == "varint" ? 2 : 0;
+    const u64 N = primes.size();
+    const int T = (int)std::max<u64>(1, std::min<u64>((u64)std::max(1, c.threads), N));
+    std::vector<u64> off(T + 1, 0);
+    MappedFile mf;
+    bool ok = true;
+    Barrier sized(T);
+
+    auto worker = [&](int t) {
+        const u64 L = N * t / T, R = N * (t + 1) / T;
+        u64 prev = (fmt == 2 && L > 0) ? primes[L - 1] : 0;
+        const u64 first_prev = prev;
+
+        u64 bytes = 0;
+        auto it = cursor_at(primes, L);
+        for (u64 i = L; i < R; ++i, ++it) {
+            u64 p = *it;
+            bytes += fmt == 0 ? (u64)digits10(p) + 1 : fmt == 1 ? 8 : (u64)varint_len(p - prev);
+            prev = p;
+        }
+        off[t + 1] = bytes;
+        sized.wait([&] {
+            for (int k = 0; k < T; ++k) off[k + 1] += off[k];
+            ok = mf.create(c.output_file, (size_t)off[T]);
+            });
+        if (!ok) return;
+
+        char* d = mf.p + off[t];
+        prev = first_prev;
+        it = cursor_at(primes, L);
+        for (u64 i = L; i < R; ++i, ++it) {
+            u64 p = *it;
+            if (fmt == 0) { d = std::to_chars(d, d + 20, p).ptr; *d++ = '\n'; }
+            else if (fmt == 1) { std::memcpy(d, &p, 8); d += 8; }
+            else {
+                u64 g = p - prev;
+                while (g >= 0x80) { *d++ = (char)(g | 0x80); g >>= 7; }
+                *d++ = (char)g;
+            }
+            prev = p;
+        }
+        };
+
+    std::vector<std::thread> ths;
+    for (int t = 1; t < T; ++t) ths.emplace_back(worker, t);
+    worker(0);
+    for (auto& th : ths) th.join();
+    if (!ok) { std::cerr << "WARN: can't map " << c.output_file << "\n"; return 0; }
+    return off[T];
+}
+
+/* ---------- prime database ---------- */
+// PTDB file (db_file=, read by "query"), all through mmap:
+//   header : DbHeader (64 bytes)
+//   index  : nblocks+1 u64, index[k] = wheel primes below block k (cumulative pi minus 2,3,5)
+//   bits   : mod-30 wheel bitmap, one byte per 30 numbers, bits for residues 1,7,...,29;
+//            blocks of DB_BLOCK bytes (122880 numbers) so pi(x) scans at most one block
+static const char PTDB_MAGIC[8] = { 'P','T','D','B','1','\0','\0','\0' };
+static constexpr u64 DB_BLOCK = 4096;
+static const unsigned char W_RES[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+static const signed char W_BIT[30] = {
+    -1, 0,-1,-1,-1,-1,-1, 1,-1,-1,-1, 2,-1, 3,-1,-1,-1, 4,-1, 5,-1,-1,-1, 6,-1,-1,-1,-1,-1, 7 };
+
+struct DbHeader {
+    char magic[8];
+    u64 hi;        // covers [2, hi]
+    u64 block;     // bytes per block
+    u64 nblocks;
+    u64 count;     // pi(hi)
+    u64 index_off, bits_off;
+    u64 reserved;
+};
+static_assert(sizeof(DbHeader) == 64, "DbHeader layout");
+
+static inline int popcnt8(unsigned v) { int c = 0; while (v) { v &= v - 1; ++c; } return c; }
+
+// Primes of [2, hi] (complete and sorted, as B1/B2 produce them) -> database file
+template <class Primes>
+static bool write_db(const std::string& path, u64 hi, const Primes& primes, int threads) {
+    const u64 nbytes = hi / 30 + 1;
+    const u64 nblocks = (nbytes + DB_BLOCK - 1) / DB_BLOCK;
+    DbHeader h{};
+    std::memcpy(h.magic, PTDB_MAGIC, sizeof h.magic);
+    h.hi = hi;
+    h.block = DB_BLOCK;
+    h.nblocks = nblocks;
+    h.count = primes.size();
+    h.index_off = sizeof(DbHeader);
+    h.bits_off = h.index_off + (nblocks + 1) * sizeof(u64);
+
+    MappedFile mf;
+    if (!mf.create(path, (size_t)(h.bits_off + nbytes))) return false;
+    std::memcpy(mf.p, &h, sizeof h);
+    unsigned char* bits = (unsigned char*)mf.p + h.bits_off;
+    u64* index = (u64*)(mf.p + h.index_off);
+    std::memset(bits, 0, (size_t)nbytes);
+    for (u64 p : primes) if (p > 5 && p <= hi && W_BIT[p % 30] >= 0) bits[p / 30] |= (unsigned char)(1u << W_BIT[p % 30]);
+
+    // per-block popcounts in parallel, then one prefix sum
+    const int T = (int)std::max<u64>(1, std::min<u64>((u64)std::max(1, threads), nblocks));
+    std::vector<std::thread> ths;
+    for (int t = 0; t < T; ++t) ths.emplace_back([&, t] {
+        for (u64 k = (u64)t; k < nblocks; k += (u64)T) {
+            u64 c = 0;
+            for (u64 i = k * DB_BLOCK, e = std::min(nbytes, i + DB_BLOCK); i < e; ++i) c += (u64)popcnt8(bits[i]);
+            index[k + 1] = c;
+        }
+        });
+    for (auto& th : ths) th.join();
+    index[0] = 0;
+    for (u64 k = 0; k < nblocks; ++k) index[k + 1] += index[k];
+    return true;
+}
+
+struct PrimeDb {
+    MappedFile mf;
+    const DbHeader* h = nullptr;
+    const u64* index = nullptr;
+    const unsigned char* bits = nullptr;
+
+    bool open(const std::string& path) {
+        if (!mf.open_read(path) || mf.n < sizeof(DbHeader)) return false;
+        h = (const DbHeader*)mf.p;
+        if (std::memcmp(h->magic, PTDB_MAGIC, sizeof h->magic) != 0 || h->block == 0 ||
+            mf.n < h->bits_off + h->hi / 30 + 1) return false;
+        index = (const u64*)(mf.p + h->index_off);
+        bits = (const unsigned char*)mf.p + h->bits_off;
+        return true;
+    }
+
+    bool is_prime(u64 n) const {
+        if (n < 7) return n == 2 || n == 3 || n == 5;
+        int b = W_BIT[n % 30];
+        return b >= 0 && (bits[n / 30] >> b & 1);
+    }
+
+    // pi(x) for x <= hi: block index + popcount of at most one block
+    u64 pi(u64 x) const {
+        if (x < 2) return 0;
+        u64 c = (x >= 2) + (x >= 3) + (x >= 5);
+        u64 byte = x / 30, k = byte / h->block;
+        c += index[k];
+        for (u64 i = k * h->block; i < byte; ++i) c += (u64)popcnt8(bits[i]);
+        unsigned mask = 0;
+        for (int j = 0; j < 8; ++j) if (W_RES[j] <= x % 30) mask |= 1u << j;
+        return c + (u64)popcnt8(bits[byte] & mask);
+    }
+
+    template <class F>
+    void each(u64 a, u64 b, F&& f) const {
+        for (u64 p : { 2ULL, 3ULL, 5ULL }) if (a <= p && p <= b) f(p);
+        for (u64 i = a / 30; i <= b / 30; ++i)
+            for (unsigned v = bits[i]; v; v &= v - 1) {
+                int j = 0;
+                while (!(v >> j & 1)) ++j;
+                u64 p = i * 30 + W_RES[j];
+                if (p >= a && p <= b && p > 5) f(p);
+            }
+    }
+};
+
+// prime_threads query <db> isprime <n> | pi <x> | range <a> <b>
+static int query_db(int argc, char** argv) {
+    PrimeDb db;
+    if (argc < 4 || !db.open(argv[2])) {
+        std::cerr << "usage: query <db> isprime <n> | pi <x> | range <a> <b>  (database must exist)\n";
+        return 1;
+    }
+    std::string op = lower(argv[3]);
+    u64 a = argc >= 5 ? std::stoull(argv[4]) : 0;
+    u64 b = argc >= 6 ? std::stoull(argv[5]) : a;
+    if (std::max(a, b) > db.h->hi) {
+        std::cerr << "ERROR: database covers [2, " << db.h->hi << "]\n";
+        return 1;
+    }
+    LineBuf& o = tls_line();
+    o.clear();
+    if (op == "isprime") o.str("isprime(").num(a).str(") = ").str(db.is_prime(a) ? "yes" : "no").ch('\n');
+    else if (op == "pi") o.str("pi(").num(a).str(") = ").num(db.pi(a)).ch('\n');
+    else if (op == "range") {
+        u64 k = (a <= b) ? db.pi(b) - (a ? db.pi(a - 1) : 0) : 0;
+        o.str("primes in [").num(a).str(", ").num(b).str("]: ").num(k).ch('\n');
+        u64 left = k;
+        db.each(a, b, [&](u64 p) { o.num(p).ch(--left ? ' ' : '\n'); out_spill(o); });
+    }
+    else { std::cerr << "ERROR: unknown query '" << op << "'\n"; return 1; }
+    out_spill(o, true);
+    return 0;
+}
+
 /* ---------- summaries ---------- */
 static void print_summary(const Config& c, const Result& r) {
-    std::cout << "\n=== Summary ===\n";
-    std::cout << "Division:  " << c.division << "   Printing: " << c.printing << "\n";
-    std::cout << "Processed: " << r.processed << " numbers\n";
-    std::cout << "Primes:    " << r.primes.size() << "\n";
+    LineBuf& b = tls_line();
+    b.clear();
+    b.str("\n=== Summary ===\n");
+    b.str("Division:  ").str(c.division).str("   Printing: ").str(c.printing).ch('\n');
+    b.str("Processed: ").num(r.processed).str(" numbers\n");
+    b.str("Primes:    ").num(r.prime_count + r.cached_primes).ch('\n');
+    if (r.cached_upto)
+        b.str("Cached:    2-").num(r.cached_upto).str(": ").num(r.cached_primes)
+        .str(" primes; new ").num(r.cached_upto + 1).ch('-').num(c.max_value).str(": ").num(r.prime_count).ch('\n');
+    if ((c.result == "stream" || r.analytics) && !r.resumed) b.str("Prime sum: ").num(r.prime_sum).ch('\n');
+    if (r.analytics && !r.resumed)
+        b.str("Max gap:   ").num(r.max_gap).str(" (after ").num(r.max_gap_after).str(")\nChecksum:  ").num(r.checksum).ch('\n');
+    if (c.division == "adaptive") b.str("Crossover: ").num(r.crossover).str(" (range below, divisor split from here)\n");
+    if (r.leases) b.str("Leases:    ").num(r.leases).str(" chunks, ").num(r.leases_again).str(" leased again after a timeout\n");
+    out_spill(b, true);
 }
 
-static void print_table(const Config& c, const Result& r) {
-    const int T = std::max(1, c.threads);
+static void print_table(const Config& c, const Result& r, FileSink* listed = nullptr) {
+    const bool served = !r.row_labels.empty();
+    const int T = served ? (int)r.row_labels.size() : std::max(1, c.threads) * c.procs;
 
-    auto range_of = [&](int t)->std::pair<u64, u64> {
-        u64 lo = (c.max_value * 1ULL * t) / T + 1;
-        u64 hi = (c.max_value * 1ULL * (t + 1)) / T;
-        if (lo < 2) lo = 2;
-        return { lo,hi };
+    // procs>1: rows are worker k's threads, k*threads + t
+    auto range_of = [&](int t) {
+        return c.procs > 1 ? thread_range(proc_config(c, t / std::max(1, c.threads)), t % std::max(1, c.threads)) : thread_range(c, t);
         };
 
-    std::cout << "\n=== Per-thread ===\n";
-    std::cout << std::left << std::setw(8) << "Thread"
-        << std::left << std::setw(20) << (c.division == "range" ? "Range" : "Owner")
-        << std::right << std::setw(14) << "Processed"
-        << std::right << std::setw(10) << "Primes" << "\n";
+    LineBuf& b = tls_line();
+    b.clear();
+    b.str("\n=== Per-thread ===\n");
+    const bool adaptive = c.division == "adaptive";
+    const char* what = c.division == "range" ? (c.backend == "omp" && !ordered_mode(c) ? "Schedule" : "Range") : adaptive ? "Strategy" : "Owner";
+    if (served) what = "Worker x chunks";
+    b.lstr(served ? "Worker" : "Thread", 8).lstr(what, 20)
+        .rstr("Processed", 14).rstr("Primes", 10);
+    if (c.thread_stats) b.rstr("Divisions", 16).rstr("Busy ms", 10);
+    if (adaptive) b.rstr("Range", 14).rstr("Split", 14);
+    b.ch('\n');
 
     for (int t = 0; t < T; ++t) {
-        std::string where = (c.division == "range")
-            ? (std::to_string(range_of(t).first) + "-" + std::to_string(range_of(t).second))
-            : "owner";
         u64 proc = (t < (int)r.proc_per_thread.size()) ? r.proc_per_thread[t] : 0;
         u64 p = (t < (int)r.primes_per_thread.size()) ? r.primes_per_thread[t] : 0;
 
-        std::cout << std::left << std::setw(8) << t
-            << std::left << std::setw(20) << where
-            << std::right << std::setw(14) << proc
-            << std::right << std::setw(10) << p << "\n";
+        b.lnum((u64)t, 8);
+        size_t at = b.size();
+        if (served)                     b.str(r.row_labels[(size_t)t]);
+        else if (ordered_mode(c))       b.str("ordered chunks");
+        else if (c.backend == "omp" && c.division == "range") b.str("omp ").str(c.omp_schedule);
+        else if (c.division == "range") b.num(range_of(t).first).ch('-').num(range_of(t).second);
+        else if (adaptive)         b.str("range+split");
+        else                       b.str("owner");
+        size_t wn = b.size() - at;
+        if (wn < 20) b.ch(' ', 20 - wn);
+        u64 divs = (t < (int)r.divisions_per_thread.size()) ? r.divisions_per_thread[t] : 0;
+        u64 busy = (t < (int)r.busy_ns_per_thread.size()) ? r.busy_ns_per_thread[t] : 0;
+        b.rnum(proc, 14).rnum(p, 10);
+        if (c.thread_stats) b.rnum(divs, 16).rnum(busy / 1000000, 10);
+        if (adaptive) {
+            u64 split = (t < (int)r.split_per_thread.size()) ? r.split_per_thread[t] : 0;
+            b.rnum(proc - split, 14).rnum(split, 14);
+        }
+        b.ch('\n');
+    }
+
+    auto list = [&](const auto& primes) {
+        if (!c.list_primes || primes.empty()) return;
+        b.str("\nPrimes:\n");
+        u64 left = primes.size();
+        for (u64 p : primes) {
+            b.num(p).ch(--left ? ' ' : '\n');
+            out_spill(b);
+        }
+        };
+    list(r.primes);
+    list(r.packed);
+    out_spill(b, true);
+    if (c.list_primes && listed) listed->dump_stdout();
+}
+
+/* ---------- binary log decoder ---------- */
+// prime_threads decode <file> [immediate|deferred]
+static int decode_log(const std::string& path, std::string layout) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof PTLOG_MAGIC];
+    unsigned char hdr[4];
+    if (!in || !in.read(magic, sizeof magic) || std::memcmp(magic, PTLOG_MAGIC, sizeof magic) != 0
+        || !in.read((char*)hdr, sizeof hdr)) {
+        std::cerr << "ERROR: " << path << " is not a prime_threads binary log.\n";
+        return 1;
+    }
+    unsigned short w_tid;
+    std::memcpy(&w_tid, hdr + 2, sizeof w_tid);
+    layout = lower(layout);
+    PrintMode pm = layout.empty() ? (hdr[0] ? PrintMode::DEFERRED : PrintMode::IMMEDIATE)
+        : (layout == "deferred" ? PrintMode::DEFERRED : PrintMode::IMMEDIATE);
+
+    Logger log(pm);
+    log.w_tid = std::max(2, (int)w_tid);
+
+    std::vector<Ev> evs;
+    std::vector<unsigned char> blk;
+    long long base_us;
+    unsigned len;
+    while (in.read((char*)&base_us, sizeof base_us) && in.read((char*)&len, sizeof len)) {
+        blk.resize(len);
+        if (!in.read((char*)blk.data(), len)) { std::cerr << "WARN: truncated block, stopping.\n"; break; }
+        const unsigned char* p = blk.data();
+        const unsigned char* e = p + len;
+        long long us = base_us;
+        u64 last_n = 0;
+        while (p < e) {
+            const bool text = (*p & 0x80) != 0;
+            Tag tag = (Tag)(*p++ & 0x7f);
+            u64 tid1, zz, v;
+            if (!get_varint(p, e, tid1) || !get_varint(p, e, zz) || !get_varint(p, e, v)) break;
+            us += (long long)(zz >> 1) ^ -(long long)(zz & 1);
+            Ev ev{ std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(us))),
+                (int)tid1 - 1, tag, 0, {} };
+            if (!text) { last_n += v; ev.n = last_n; }
+            else {
+                if ((u64)(e - p) < v) break;
+                ev.msg.assign((const char*)p, (size_t)v);
+                p += v;
+            }
+            evs.push_back(std::move(ev));
+        }
     }
 
-    if (c.list_primes && !r.primes.empty()) {
-        std::cout << "\nPrimes:\n";
-        for (size_t i = 0; i < r.primes.size(); ++i)
-            std::cout << r.primes[i] << (i + 1 < r.primes.size() ? ' ' : '\n');
+    if (pm == PrintMode::IMMEDIATE) {
+        std::stable_sort(evs.begin(), evs.end(), [](const Ev& a, const Ev& b) { return a.tp < b.tp; });
+        for (auto& ev : evs) log.replay(ev);
+    }
+    else {
+        log.buf = std::move(evs);
+        log.flush_deferred();
     }
+    return 0;
 }
 
 /* ---------- main ---------- */
 int main(int argc, char** argv) {
+    if (argc >= 3 && lower(argv[1]) == "decode") return decode_log(argv[2], argc >= 4 ? argv[3] : "");
+    if (argc >= 2 && lower(argv[1]) == "query")  return query_db(argc, argv);
+    // serve <addr> [variant] runs like a normal run whose numbers are computed by `work` instances
+    std::string serve_addr;
+#if !defined(_WIN32)
+    if (argc >= 3 && lower(argv[1]) == "work")   return work_main(argv[2], argc >= 4 ? argv[3] : "");
+    if (argc >= 3 && lower(argv[1]) == "serve") { serve_addr = argv[2]; ::signal(SIGPIPE, SIG_IGN); }
+#else
+    if (argc >= 2 && (lower(argv[1]) == "serve" || lower(argv[1]) == "work")) {
+        std::cerr << "serve/work need POSIX sockets and are not available on Windows.\n";
+        return 1;
+    }
+#endif
+
     Config cfg = load_cfg("config.ini");
 
-    int vidx = (argc >= 2 ? find_var(argv[1]) : -1);
+    int vidx = serve_addr.empty() ? (argc >= 2 ? find_var(argv[1]) : -1) : find_var(argc >= 4 ? argv[3] : "a1b1");
     if (vidx < 0) {
         vidx = ask_variant();
         if (vidx < 0) { std::cout << "Goodbye.\n"; return 0; }
     }
-    cfg.division = VARS[vidx].div;
+    if (cfg.division != "adaptive") cfg.division = VARS[vidx].div;
     cfg.printing = VARS[vidx].print;
 
+    // cache_file: resume counting after the cached frontier when it is compatible
+    RunCache cache;
+    bool save = !cfg.cache_file.empty();
+    if (save && load_cache(cfg.cache_file, cache)) {
+        if (cache.skip_even != cfg.skip_even || cache.use_6k != cfg.use_6k) {
+            std::cerr << "WARN: " << cfg.cache_file << " was built with other skip_even/use_6k, ignoring it.\n";
+            cache = {};
+        }
+        else if (cache.frontier > cfg.max_value) {
+            std::cerr << "WARN: " << cfg.cache_file << " reaches past max_value, recomputing (cache kept).\n";
+            cache = {};
+            save = false;
+        }
+        else cfg.start_after = cache.frontier;
+    }
+
+#if !defined(_OPENMP)
+    if (cfg.backend == "omp") {
+        std::cerr << "WARN: built without OpenMP, backend=omp falls back to threads.\n";
+        cfg.backend = "threads";
+    }
+#endif
+#if defined(_WIN32)
+    if (cfg.procs > 1) {
+        std::cerr << "WARN: procs needs fork and POSIX shared memory, running in one process.\n";
+        cfg.procs = 1;
+    }
+#endif
+    std::string cpu_why;
+    const int cpu_avail = detect_threads(cfg.smt, cpu_why);
+    if (cfg.threads_auto) cfg.threads = std::max(1, cpu_avail / cfg.procs);
+    else if (cfg.threads * cfg.procs > cpu_avail)
+        std::cerr << "WARN: " << (cfg.procs > 1 ? "threads x procs=" : "threads=") << cfg.threads * cfg.procs << " exceeds the "
+        << cpu_avail << " CPUs available (" << cpu_why << "), threads will share cores; threads=auto sizes to fit.\n";
+    cfg.pin_cpus = resolve_affinity(cfg.affinity);
+    if (cfg.pin_cpus.empty() && cfg.affinity != "none")
+        std::cerr << "WARN: affinity=" << cfg.affinity << " gave no CPUs, threads are not pinned.\n";
+
+    // procs>1: fork the workers here, before this process starts any thread. Worker k
+    // continues through main on its slice and returns after reporting the run.
+    if (!serve_addr.empty() && cfg.procs > 1) {
+        std::cerr << "WARN: procs is ignored by serve (start several work instances instead).\n";
+        cfg.procs = 1;
+    }
+    const int tid_slots = std::max(1, cfg.threads) * cfg.procs;
+    int proc_k = -1, proc_failed = 0;
+
     PrintMode pm = (cfg.printing == "deferred") ? PrintMode::DEFERRED : PrintMode::IMMEDIATE;
     Logger log(pm);
-    log.set_width(std::max(1, cfg.threads));
+    log.set_width(tid_slots);
+    log.mask = resolve_tag_mask(cfg.log_level, cfg.log_tags);
+    if (pm == PrintMode::DEFERRED) log.set_memory_limit(cfg.deferred_memory_limit);
+#if !defined(_WIN32)
+    ProcRegion proc_reg;
+    std::vector<pid_t> proc_pids;
+    const u64 coord = process_id();
+    if (cfg.procs > 1) {
+        if (!cfg.checkpoint_file.empty()) {
+            std::cerr << "WARN: checkpoint_file is not supported with procs>1, running without it.\n";
+            cfg.checkpoint_file.clear();
+        }
+        if (cfg.log_format == "binary") {
+            std::cerr << "WARN: log_format=binary is not supported with procs>1, logging as text.\n";
+            cfg.log_format = "text";
+        }
+        if (!proc_reg.create(cfg.procs, std::max(1, cfg.threads))) {
+            std::cerr << "WARN: can't create the shared-memory region, running in one process.\n";
+            cfg.procs = 1;
+        }
+    }
+#endif
+
+    // binary log and async stdout first, so the startup lines below go through them
+    // (procs>1 logs as text)
+    BinLog bin;
+    if (cfg.log_format == "binary") {
+        if (bin.open(cfg.log_file, pm, log.w_tid)) log.bin = &bin;
+        else std::cerr << "WARN: can't open " << cfg.log_file << ", logging as text.\n";
+    }
 
+    std::unique_ptr<AsyncWriter> async_out;
+    auto start_async = [&] {
+        if (!cfg.async_output && !cfg.zero_copy) return;
+        async_out.reset(new AsyncWriter((size_t)cfg.async_buffer, cfg.async_buffers, cfg.zero_copy));
+        async_out->attach_stdout(cfg.procs > 1);
+        g_async_out = async_out.get();
+        log.run(std::string("Async output via ") + async_out->backend());
+        };
+
+    // the coordinator's startup lines go out before any worker process exists
     log.run("Program started");
+    if (cfg.procs == 1) start_async();
+    if (cfg.procs > 1) log.run("Procs=" + std::to_string(cfg.procs) + "  threads=" + std::to_string(cfg.threads) + " each");
+    if (cfg.threads_auto) log.run("Threads=auto -> " + std::to_string(cfg.threads) + "  (" + cpu_why + (cfg.smt ? "" : " smt=0") + ")");
+    if (!cfg.pin_cpus.empty()) {
+        std::string cpus;
+        for (int t = 0; t < std::max(1, cfg.threads); ++t)
+            cpus += (t ? "," : "") + std::to_string(cfg.pin_cpus[(size_t)t % cfg.pin_cpus.size()]);
+        log.run("Affinity=" + cfg.affinity + "  cpus=" + cpus);
+    }
+    if (cfg.procs > 1 && cfg.result == "stream")
+        std::cerr << "WARN: result=stream with procs>1: each worker keeps its slice's primes until it reports, "
+        "so memory is not bounded by segment.\n";
+
+#if !defined(_WIN32)
+    static ProcOut proc_out;
+    if (cfg.procs > 1) {
+        std::cout.flush();
+        std::fflush(stdout);
+        for (int k = 0; k < cfg.procs && proc_k < 0; ++k) {
+            const pid_t pid = fork();
+            if (pid == 0) proc_k = k;
+            else if (pid > 0) proc_pids.push_back(pid);
+            else { std::cerr << "WARN: fork failed for worker process " << k << "\n"; break; }
+        }
+    }
+    if (proc_k >= 0) {
+        const int T = std::max(1, cfg.threads);
+        if (!cfg.pin_cpus.empty())
+            std::rotate(cfg.pin_cpus.begin(), cfg.pin_cpus.begin() + (ptrdiff_t)(((size_t)proc_k * T) % cfg.pin_cpus.size()), cfg.pin_cpus.end());
+        cfg = proc_config(cfg, proc_k);
+        g_proc_out = &proc_out;
+        proc_out.lines = (pm == PrintMode::IMMEDIATE);
+        log.tid_base = proc_k * T;
+        log.run_prefix = "Worker " + std::to_string(proc_k) + " (" + std::to_string(cfg.start_after + 1) + "-" + std::to_string(cfg.max_value) + "): ";
+        cfg.result = "store";  // the coordinator feeds the sinks, in slice order
+        cfg.async_output = cfg.zero_copy = false;
+        cfg.output_file.clear();
+        cfg.db_file.clear();
+        save = false;
+    }
+#endif
+
+    // procs>1: the writer starts threads, so the coordinator only starts it after forking
+    if (cfg.procs > 1 && proc_k < 0) start_async();
+
+    // result=stream: Result keeps aggregates only, primes flow through the sinks
+    const bool stream = (cfg.result == "stream");
+    const int lanes = (cfg.division == "range") ? std::max(1, cfg.threads) : (cfg.division == "adaptive") ? std::max(1, cfg.threads) + 1 : 1;
+    CountSink count_sink;
+    SumSink sum_sink;
+    std::unique_ptr<FileSink> file_sink, list_sink;
+    SinkSet sinks;
+    if (stream) {
+        sinks.v = { &count_sink, &sum_sink };
+        const size_t async_bytes = cfg.async_output ? (size_t)cfg.async_buffer : 0;
+        if (!cfg.primes_file.empty()) { file_sink.reset(new FileSink(cfg.primes_file, lanes, '\n', async_bytes, cfg.async_buffers)); sinks.v.push_back(file_sink.get()); }
+        if (cfg.list_primes) { list_sink.reset(new FileSink("", lanes, ' ')); sinks.v.push_back(list_sink.get()); }
+    }
+    SinkSet* sp = stream ? &sinks : nullptr;
+
+    std::unique_ptr<Checkpoint> ck;
+    if (!cfg.checkpoint_file.empty() && ordered_mode(cfg))
+        std::cerr << "WARN: checkpoint_file is not supported with ordered=1, running without it.\n";
+    else if (!cfg.checkpoint_file.empty() && cfg.backend == "omp" && cfg.division == "range")
+        std::cerr << "WARN: checkpoint_file is not supported with backend=omp range division, running without it.\n";
+    else if (!cfg.checkpoint_file.empty() && !serve_addr.empty())
+        std::cerr << "WARN: checkpoint_file is not supported with serve, running without it.\n";
+    else if (!cfg.checkpoint_file.empty() && cfg.division == "adaptive")
+        std::cerr << "WARN: checkpoint_file is not supported with division=adaptive, running without it.\n";
+    else if (!cfg.checkpoint_file.empty()) {
+        const size_t slots = (cfg.division == "range") ? (size_t)std::max(1, cfg.threads) : (size_t)std::max(1, cfg.threads) + 1;
+        ck.reset(new Checkpoint(cfg.checkpoint_file, cfg, slots));
+        if (cfg.resume) {
+            if (ck->load()) log.run("Resuming from " + cfg.checkpoint_file);
+            else std::cerr << "WARN: no matching checkpoint in " << cfg.checkpoint_file << ", starting over.\n";
+        }
+        ck->start(cfg.checkpoint_ms);
+    }
+    else if (cfg.resume) std::cerr << "WARN: resume=1 needs checkpoint_file, starting over.\n";
 
     Result r;
-    if (cfg.division == "range") r = run_B1(cfg, log);
-    else                       r = run_B2(cfg, log);
+#if !defined(_WIN32)
+    if (!serve_addr.empty()) {
+        r = serve_run(cfg, log, sp, serve_addr, proc_failed);
+        // nothing to report, and an empty Result must not reach cache_file or the outputs
+        if (proc_failed) {
+            std::cerr << "WARN: serve did not complete, nothing saved.\n";
+            return 1;
+        }
+    }
+    else if (cfg.procs > 1) r = proc_collect(cfg, log, sp, proc_reg, proc_pids, proc_failed);
+    else
+#endif
+    r = run_engine(cfg, log, sp, ck.get());
+#if !defined(_WIN32)
+    if (proc_k >= 0) {
+        const bool ok = proc_report(proc_reg, coord, proc_k, cfg, log, r);
+        proc_out.flush();
+        return ok ? 0 : 1;
+    }
+#endif
+    const bool resumed = ck && ck->resumed;
+    const u64 restored = ck ? ck->restored : 0;
+    if (ck) ck->finish();
+    if (stream) {
+        sinks.close();
+        r.prime_count = count_sink.count.load() + restored;
+        r.prime_sum = sum_sink.sum.load();
+    }
+    r.resumed = resumed;
+    if (resumed && (cfg.list_primes || !cfg.primes_file.empty()))
+        std::cerr << "WARN: list_primes/primes_file hold only the primes found after the resume.\n";
+    r.cached_upto = cfg.start_after;
+    r.cached_primes = cfg.start_after ? cache.primes : 0;
+    // proc_failed: a worker's slice is missing from r, so nothing built from r may be saved
+    if (save && proc_failed) std::cerr << "WARN: " << cfg.cache_file << " not updated, the run is incomplete.\n";
+    else if (save && !save_cache(cfg.cache_file, { cfg.max_value, r.prime_count + r.cached_primes, cfg.skip_even, cfg.use_6k }))
+        std::cerr << "WARN: can't write " << cfg.cache_file << "\n";
+
+    // cache_file: this run only saw (start_after, max_value]; the cache holds counts, not primes
+    if (cfg.start_after && (cfg.list_primes || !cfg.primes_file.empty()))
+        std::cerr << "WARN: list_primes/primes_file hold only the new primes " << cfg.start_after + 1 << "-" << cfg.max_value
+        << "; [2, " << cfg.start_after << "] came from " << cfg.cache_file << ".\n";
+    if (!cfg.output_file.empty()) {
+        if (stream) std::cerr << "WARN: output_file needs result=store; use primes_file with result=stream.\n";
+        else if (cfg.start_after || resumed || proc_failed) std::cerr << "WARN: output_file not written (needs a complete run without cache or resume).\n";
+        else {
+            u64 bytes = (cfg.prime_store == "gaps") ? write_output(cfg, r.packed) : write_output(cfg, r.primes);
+            log.run("Output file " + cfg.output_file + " (" + cfg.output_format + "): " + std::to_string(bytes) + " bytes");
+        }
+    }
+    if (!cfg.db_file.empty() && (cfg.use_6k || !cfg.skip_even))
+        std::cerr << "WARN: prime database not written (use_6k=1 / skip_even=false list composites, the database needs exact primes)\n";
+    else if (!cfg.db_file.empty()) {
+        bool ok = !stream && !cfg.start_after && !resumed && !proc_failed && ((cfg.prime_store == "gaps")
+            ? write_db(cfg.db_file, cfg.max_value, r.packed, cfg.threads)
+            : write_db(cfg.db_file, cfg.max_value, r.primes, cfg.threads));
+        if (ok) log.run("Prime database " + cfg.db_file + ": [2, " + std::to_string(cfg.max_value) + "]");
+        else std::cerr << "WARN: prime database not written (needs result=store, a complete run without cache, no resume, and a writable " << cfg.db_file << ")\n";
+    }
 
     log.run("Program finished");
 
-    if (pm == PrintMode::DEFERRED) log.flush_deferred();
+    if (log.bin) bin.close();
+    else if (pm == PrintMode::DEFERRED) log.flush_deferred();
     print_summary(cfg, r);
-    if (cfg.table_sum) print_table(cfg, r);
+    if (cfg.table_sum) print_table(cfg, r, list_sink.get());
+    if (async_out) { g_async_out = nullptr; async_out->close(); }
+#if !defined(_WIN32)
+    proc_out.flush();
+#endif
 
-    return 0;
+    return proc_failed ? 1 : 0;
 }
\ No newline at end of file